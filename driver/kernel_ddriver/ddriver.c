@@ -4,6 +4,12 @@
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
 #include "ddriver_ctl.h"
 /******************************************************************************
 * SECTION: Macro definitions
@@ -25,10 +31,13 @@
                         ".Note we use filp_open to read or write the fake disk, "\
                         "referring to <https://cpp.hotexamples.com/examples/-/-/"\
                         "filp_open/cpp-filp_open-function-examples.html>"
-#define DRIVER_VERSION  "0.1.0"
+#define DRIVER_VERSION  "0.2.0"
 
 #define CONFIG_DISK_SZ  (4 * 1024 * 1024)
 #define CONFIG_BLOCK_SZ (512)
+
+#define CONFIG_STRIPE_SZ (64 * 1024)                  /* Layout bytes guarded by one lock */
+#define CONFIG_STRIPE_NUM (CONFIG_DISK_SZ / CONFIG_STRIPE_SZ)
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
@@ -36,14 +45,7 @@
 #define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
 #define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
 
-#define GET_HEAD_POS(disk)      (disk.head - disk.layout)
-#define FORWARD_HEAD(disk, dis) (disk.head += dis)
-#define SET_HEAD(disk, ofs)     (disk.head = disk.layout + ofs)
-#define RESET_HEAD(disk)        (SET_HEAD(disk, 0))
-
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define STRIPE_OF(pos)          ((pos) / CONFIG_STRIPE_SZ)
 /******************************************************************************
 * SECTION: Kernel Module Template
 *******************************************************************************/
@@ -57,55 +59,133 @@ MODULE_VERSION(DRIVER_VERSION);
 struct ddriver
 {
     char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
-    char *head;                                       /* Disk Head */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    struct rw_semaphore stripe_lock[CONFIG_STRIPE_NUM];
+                                                      /* Readers share a stripe, a writer owns it */
+    struct ddriver_stat64 stat;                       /* I/O statistics */
+    spinlock_t stat_lock;                             /* Protects stat and every file's head */
     int  major_num;
-    int  open_count;
+    atomic_t open_count;
     int  layout_size;
     int  iounit_size;
 };
 
+struct ddriver_file                                   /* Per open file, kept in file->private_data */
+{
+    loff_t head;                                      /* Where this file's last I/O ended, 
+                                                         a request elsewhere counts as a seek */
+};
+
 static struct ddriver disk = {
-    .head        = NULL,
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
     .major_num   = 0,
-    .open_count  = 0,
+    .open_count  = ATOMIC_INIT(0),
     .layout_size = CONFIG_DISK_SZ,
     .iounit_size = CONFIG_BLOCK_SZ
 };
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
+int check_valid(loff_t pos, size_t size){
+    if (pos < 0 || pos >= CONFIG_DISK_SZ) {
         kernel_alert("disk head reach the end");
         return -EINVAL;
     }
-    if (size != CONFIG_BLOCK_SZ){
+    if (!IS_ADDR_ALIGN(pos)) {
+        kernel_alert("offset %lld must be aligned to block size %d", pos, CONFIG_BLOCK_SZ);
+        return -EINVAL;
+    }
+    if (size == 0 || !IS_ADDR_ALIGN(size)){
         kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
         return -EIO;
     }
+    if (pos + size > CONFIG_DISK_SZ) {
+        kernel_alert("io [%lld, %lld) out of device", pos, pos + (loff_t)size);
+        return -EINVAL;
+    }
     return 0;
 }
+/**
+ * @brief Lock the stripes covering [pos, pos + size), always in ascending order
+ *        so that requests spanning several stripes can not deadlock.
+ * 
+ * @param pos           Start of the range
+ * @param size          Length of the range, not 0
+ * @param write         Exclusive for writes, shared for reads
+ */
+void lock_range(loff_t pos, size_t size, int write){
+    int i;
+    for (i = STRIPE_OF(pos); i <= STRIPE_OF(pos + size - 1); i++) {
+        if (write)
+            down_write(&disk.stripe_lock[i]);
+        else
+            down_read(&disk.stripe_lock[i]);
+    }
+}
+
+void unlock_range(loff_t pos, size_t size, int write){
+    int i;
+    for (i = STRIPE_OF(pos + size - 1); i >= STRIPE_OF(pos); i--) {
+        if (write)
+            up_write(&disk.stripe_lock[i]);
+        else
+            up_read(&disk.stripe_lock[i]);
+    }
+}
+/**
+ * @brief Account a head movement of one file. Caller holds disk.stat_lock.
+ */
+void account_seek(struct ddriver_file *fh, loff_t pos){
+    disk.stat.seek_cnt++;
+    disk.stat.seek_dist += abs(pos - fh->head);
+    fh->head = pos;
+}
+/**
+ * @brief Account one finished request. There is no latency model in the
+ *        kernel driver, so the latency is the time spent copying the block.
+ * 
+ * @param fh            File issuing the request
+ * @param write         Write or read
+ * @param pos           Where the request started
+ * @param size          Bytes transferred
+ * @param lat_ns        Latency in ns
+ */
+void account_io(struct ddriver_file *fh, int write, loff_t pos, size_t size, u64 lat_ns){
+    int bucket = fls64(lat_ns);                       /* bucket i holds [2^(i-1), 2^i) ns */
+    if (bucket >= DDRIVER_HIST_BUCKETS)
+        bucket = DDRIVER_HIST_BUCKETS - 1;
+    spin_lock(&disk.stat_lock);
+    if (fh->head != pos)
+        account_seek(fh, pos);
+    fh->head = pos + size;
+    if (write) {
+        disk.stat.write_cnt++;
+        disk.stat.write_bytes += size;
+        disk.stat.write_lat_ns += lat_ns;
+        disk.stat.write_hist[bucket]++;
+    }
+    else {
+        disk.stat.read_cnt++;
+        disk.stat.read_bytes += size;
+        disk.stat.read_lat_ns += lat_ns;
+        disk.stat.read_hist[bucket]++;
+    }
+    spin_unlock(&disk.stat_lock);
+}
 /******************************************************************************
 * SECTION: Function definitions
 *******************************************************************************/
 static int      device_open(struct inode *, struct file *);
 static int      device_release(struct inode *, struct file *);
-static ssize_t  device_read(struct file *, char *, size_t, loff_t *);
-static ssize_t  device_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t  device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t  device_write_iter(struct kiocb *, struct iov_iter *);
 static loff_t   device_seek(struct file *, loff_t, int);
 static long     device_ioctl(struct file *, unsigned int, unsigned long);
 /******************************************************************************
 * SECTION: Global var or structure definitions
 *******************************************************************************/
 static struct file_operations file_ops = {
-    .read = device_read,
-    .write = device_write,
+    .owner = THIS_MODULE,
+    .read_iter = device_read_iter,
+    .write_iter = device_write_iter,
     .open = device_open,
     .llseek = device_seek,
     .unlocked_ioctl = device_ioctl,
@@ -115,61 +195,73 @@ static struct file_operations file_ops = {
 * SECTION: Function Implementation
 *******************************************************************************/
 /**
- * @brief Disk Read
+ * @brief Disk Read, at iocb->ki_pos so that read() and pread() both work.
+ *        Readers of the same stripe run concurrently.
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param iocb          Position and file
+ * @param to            User space buffers, total size a multiple of @CONFIG_BLOCK_SZ
  * @return ssize_t      Bytes have been read 
  */
 static ssize_t 
-device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
+device_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct ddriver_file *fh = iocb->ki_filp->private_data;
+    loff_t pos = iocb->ki_pos;
+    size_t size = iov_iter_count(to);
+    size_t copied;
+    u64 start = ktime_get_ns();
+    int res = check_valid(pos, size);
     if(res < 0)
         return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
+
+    lock_range(pos, size, 0);
+    copied = copy_to_iter(disk.layout + pos, size, to);
+    unlock_range(pos, size, 0);
+    if (copied == 0)
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    iocb->ki_pos = pos + copied;
+    account_io(fh, 0, pos, copied, ktime_get_ns() - start);
+    return copied;
 }
 /**
- * @brief Disk Write
+ * @brief Disk Write, at iocb->ki_pos. A writer excludes everyone else only
+ *        on the stripes it touches.
  * 
- * @param file          Ignored
- * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param iocb          Position and file
+ * @param from          User space buffers, copy content from
  * @return ssize_t      Bytes have been written
  */
 static ssize_t 
-device_write(struct file *file, const char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
+device_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct ddriver_file *fh = iocb->ki_filp->private_data;
+    loff_t pos = iocb->ki_pos;
+    size_t size = iov_iter_count(from);
+    size_t copied;
+    u64 start = ktime_get_ns();
+    int res = check_valid(pos, size);
     if(res < 0)
         return res;
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
+    lock_range(pos, size, 1);
+    copied = copy_from_iter(disk.layout + pos, size, from);
+    unlock_range(pos, size, 1);
+    if (copied == 0)
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    iocb->ki_pos = pos + copied;
+    account_io(fh, 1, pos, copied, ktime_get_ns() - start);
+    return copied;
 }
 /**
- * @brief Disk Seek
+ * @brief Disk Seek, moves only this file's position
  * 
- * @param file          Ignored
+ * @param file          Opened device
  * @param offset        Aligned to @CONFIG_BLOCK_SZ
- * @param whence        SEEK_CUR, SEEK_SET
+ * @param whence        SEEK_CUR, SEEK_SET, SEEK_END
  * @return loff_t       cur pos
  */
 static loff_t 
 device_seek(struct file *file, loff_t offset, int whence) {
-    IGNORE_ARG(file);
+    struct ddriver_file *fh = file->private_data;
+    loff_t pos;
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
                       offset, CONFIG_BLOCK_SZ);
@@ -178,30 +270,40 @@ device_seek(struct file *file, loff_t offset, int whence) {
     switch (whence)
     {
     case SEEK_SET:
-        SET_HEAD(disk, offset);
+        pos = offset;
         break;
     case SEEK_CUR:
-        FORWARD_HEAD(disk, offset);
+        pos = file->f_pos + offset;
         break;
-    default:
+    case SEEK_END:
+        pos = CONFIG_DISK_SZ + offset;
         break;
+    default:
+        return -EINVAL;
     }
-    INC_SEEKCNT(disk);
-    return GET_HEAD_POS(disk);
+    if (pos < 0 || pos > CONFIG_DISK_SZ)
+        return -EINVAL;
+    file->f_pos = pos;
+    spin_lock(&disk.stat_lock);
+    account_seek(fh, pos);
+    spin_unlock(&disk.stat_lock);
+    return pos;
 }
 /**
  * @brief Disk ioctl
  * 
- * @param file          Ignored
+ * @param file          Opened device
  * @param cmd           Command
  * @param arg           Args
  * @return long         State
  */
 static long 
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-    IGNORE_ARG(file);
+    struct ddriver_file *fh = file->private_data;
     int ret;
     struct ddriver_state state;
+    struct ddriver_stat64 *stat;
+    long long size;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
@@ -209,19 +311,40 @@ device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
         if (ret) 
             return -EFAULT;
         break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size (64-bit) */
+        size = disk.layout_size;
+        ret = copy_to_user((long long __user *)arg, &size, sizeof(long long));
+        if (ret) 
+            return -EFAULT;
+        break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        spin_lock(&disk.stat_lock);
+        state.read_cnt = disk.stat.read_cnt;
+        state.write_cnt = disk.stat.write_cnt;
+        state.seek_cnt = disk.stat.seek_cnt;
+        spin_unlock(&disk.stat_lock);
         ret = copy_to_user((int __user *)arg, &state, sizeof(struct ddriver_state));
         if (ret) 
             return -EFAULT;
         break;
-    case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        disk.head = disk.layout;
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+    case IOC_REQ_DEVICE_STAT64:                       /* 64-bit Device Statistics */
+        stat = kmalloc(sizeof(struct ddriver_stat64), GFP_KERNEL);
+        if (!stat)                                    /* Snapshot, copy_to_user may sleep */
+            return -ENOMEM;
+        spin_lock(&disk.stat_lock);
+        *stat = disk.stat;
+        spin_unlock(&disk.stat_lock);
+        ret = copy_to_user((void __user *)arg, stat, sizeof(struct ddriver_stat64));
+        kfree(stat);
+        if (ret) 
+            return -EFAULT;
+        break;
+    case IOC_REQ_DEVICE_RESET:                        /* Reset Device: head and counters only, data is kept */
+        file->f_pos = 0;
+        spin_lock(&disk.stat_lock);
+        fh->head = 0;
+        memset(&disk.stat, 0, sizeof(struct ddriver_stat64));
+        spin_unlock(&disk.stat_lock);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         ret = copy_to_user((int __user *)arg, &disk.iounit_size, sizeof(int));
@@ -234,40 +357,36 @@ device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
     return 0;
 }
 /**
- * @brief Disk Open
+ * @brief Disk Open, any number of files may be open at the same time
  * 
  * @param inode         Ignored
- * @param file          Ignored
+ * @param file          Gets its own head at 0
  * @return int          state
  */
 static int 
 device_open(struct inode *inode, struct file *file) {
+    struct ddriver_file *fh = kzalloc(sizeof(struct ddriver_file), GFP_KERNEL);
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
-    
-    if (disk.open_count) {                            /* If device is open, return busy */
-        return -EBUSY;
-    }
-    RESET_HEAD(disk);                                 /* Everytime close device, reset head */
-    disk.open_count++;
-    try_module_get(THIS_MODULE);
+    if (!fh)
+        return -ENOMEM;
+    file->private_data = fh;
+    file->f_pos = 0;
+    atomic_inc(&disk.open_count);
     return 0;
 }
 /**
  * @brief Disk Close
  * 
  * @param inode         Ignored
- * @param file          Ignored
+ * @param file          Opened device
  * @return int          state
  */
 static int 
 device_release(struct inode *inode, struct file *file) {
-                                                      /* Decrement the open counter and usage count. 
-                                                         Without this, the module would not unload. */
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
-    disk.open_count--;
-    module_put(THIS_MODULE);
+    kfree(file->private_data);
+    file->private_data = NULL;
+    atomic_dec(&disk.open_count);
     return 0;
 }
 /******************************************************************************
@@ -276,7 +395,14 @@ device_release(struct inode *inode, struct file *file) {
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int i;
+    int major_num;
+    for (i = 0; i < CONFIG_STRIPE_NUM; i++)
+        init_rwsem(&disk.stripe_lock[i]);
+    spin_lock_init(&disk.stat_lock);
+    memset(disk.layout, 0, CONFIG_DISK_SZ);
+
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
@@ -285,7 +411,6 @@ ddriver_init(void)
     else {                                            /* Register success */                                                  
         kernel_info("module loaded with device major number %d", major_num);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
         return 0;
     }
     return 0;
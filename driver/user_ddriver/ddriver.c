@@ -5,11 +5,18 @@
 #include <fcntl.h>
 #include "string.h"
 #include <linux/fs.h>
+#include <sys/uio.h>
 #include "ddriver_ctl.h"
+#include "ddriver.h"
 #include "stdio.h"
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <limits.h>
 
 extern int errno;
 
@@ -44,52 +51,91 @@ extern int errno;
 #define DRIVER_DESC     "A Fake disk driver in user space"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
-#define CONFIG_BLOCK_SZ (512)
+#define CONFIG_DISK_SZ  (4 * 1024 * 1024)             /* 默认设备大小，可由环境变量DDRIVER_DISK_SZ覆盖 */
+#define CONFIG_BLOCK_SZ (512)                         /* 默认扇区大小，可由环境变量DDRIVER_BLOCK_SZ覆盖 */
+#define CONFIG_BLOCK_SZ_MAX (64 * 1024)
+#define CONFIG_META_SZ  (512)                         /* 镜像末尾记录设备参数的区域大小 */
+#define CONFIG_META_MAGIC (0x44524D45)
+#define CONFIG_IOV_MAX  (1024)                        /* 单次向量I/O的最大段数 */
+#define CONFIG_AIO_WORKERS (4)                        /* io_uring不可用时的线程池大小 */
+#define CONFIG_SCHED_QUEUE_MAX (1024)                 /* 调度队列最多容纳的未派发请求数 */
+#define CONFIG_AIO_ENTER_RETRY (64)                   /* io_uring_enter遇到EAGAIN/EBUSY时的最多重试次数 */
+#define CONFIG_SCHED_READ_EXPIRE_US  (500 * 1000)     /* deadline策略下读请求的最长等待时间 */
+#define CONFIG_SCHED_WRITE_EXPIRE_US (5000 * 1000)    /* deadline策略下写请求的最长等待时间 */
+#define CONFIG_CHANNELS_MAX (64)                      /* 延迟模型最多可并行服务的请求数 */
+#define CONFIG_SPIN_NS  (50 * 1000)                   /* 模拟延迟最后这段时间忙等而不睡眠 */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     ((addr) % disk.iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     (((addr) / disk.iounit_size) * disk.iounit_size)
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define STAT_ADD(field, val)    (__atomic_fetch_add(&disk.stat.field, (val), __ATOMIC_RELAXED))
 
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
+/* 延迟模型：请求耗时 = 旋转延迟 + 固定开销 + 传输时间，channels个请求可同时被服务 */
+struct ddriver_profile
+{
+    const char *name;
+    long long   read_ns;                             /* 每个读请求的固定开销 */
+    long long   write_ns;                            /* 每个写请求的固定开销 */
+    long long   rotate_ns;                           /* 旋转一整圈的延迟，0表示没有寻道开销 */
+    int         track_num;
+    int         bandwidth_mbps;                      /* 传输带宽MB/s，0表示不计传输时间 */
+    int         channels;                            /* 可并行服务的请求数 */
+};
+
 struct ddriver
 {
     int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
-    int  track_num;
+    struct ddriver_stat64 stat;                      /* I/O统计，各字段原子累加 */
+    const struct ddriver_profile *profile;           /* 延迟模型 */
+    long long chan_free_ns[CONFIG_CHANNELS_MAX];     /* 每个通道的模拟空闲时刻 */
+    pthread_mutex_t time_lock;                       /* 保护chan_free_ns */
     int  major_num;
-    int  layout_size;
+    off_t layout_size;                               /* 设备大小，镜像文件在其后另有CONFIG_META_SZ字节的参数区 */
     int  iounit_size;
+    off_t head;                                      /* 模拟磁头位置，与fd的文件位置无关 */
+    pthread_mutex_t head_lock;                       /* 保护head */
+    char *map;                                       /* mmap模式下映射的设备区，否则为NULL */
+    off_t map_pos;                                   /* mmap模式下代替fd的文件位置 */
+    off_t dirty_lo, dirty_hi;                        /* mmap模式下尚未msync的范围[lo, hi) */
+    pthread_mutex_t map_lock;                        /* 保护dirty_lo/dirty_hi */
+    int map_pins;                                    /* ddriver_map_block后尚未解除的映射数 */
+};
+
+/* 镜像末尾的设备参数，再次打开时沿用创建时的大小与扇区大小 */
+struct ddriver_meta
+{
+    unsigned int magic;
+    int          iounit_size;
+    long long    layout_size;
 };
 /******************************************************************************
 * SECTION: Global Variable
 *******************************************************************************/
 /* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
+const struct ddriver_profile ddriver_profiles[] = {
+    /* name    read_ns    write_ns   rotate_ns  tracks  MB/s  channels */
+    { "hdd",   2000000,   1000000,   4170000,   100,    150,  1  },     /* 4.17ms per 360 degree */
+    { "ssd",   80000,     200000,    0,         1,      500,  4  },
+    { "nvme",  10000,     20000,     0,         1,      3000, 32 },
+    { "none",  0,         0,         0,         1,      0,    CONFIG_CHANNELS_MAX },
+};
+
 struct ddriver disk = {
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
+    .profile     = &ddriver_profiles[0],
+    .time_lock   = PTHREAD_MUTEX_INITIALIZER,
     .major_num   = 0,
-    .track_num   = 100,
     .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
+    .iounit_size = CONFIG_BLOCK_SZ,
+    .head        = 0,
+    .head_lock   = PTHREAD_MUTEX_INITIALIZER,
+    .map         = NULL,
+    .map_lock    = PTHREAD_MUTEX_INITIALIZER
 };
 
 FILE *debugf = NULL;
@@ -97,37 +143,455 @@ FILE *debugf = NULL;
 * SECTION: Helper Functions
 *******************************************************************************/
 int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size != disk.iounit_size){
+        user_alert("io size %ld should align to %d", size, disk.iounit_size);
         return -EIO;
     }
     return 0;
 }
 
-int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
-    
-    if (distance == 0) {
+/* 向量I/O：每段长度都必须是设备IO单位的整数倍，返回总字节数 */
+ssize_t check_valid_iov(const struct iovec *iov, int iovcnt) {
+    ssize_t total = 0;
+    if (iovcnt <= 0 || iovcnt > CONFIG_IOV_MAX) {
+        user_alert("iovcnt %d out of range", iovcnt);
+        return -EINVAL;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0 || !IS_ADDR_ALIGN(iov[i].iov_len)) {
+            user_alert("iov[%d] size %ld should align to %d", 
+                       i, iov[i].iov_len, disk.iounit_size);
+            return -EIO;
+        }
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+/* 解析形如"1G"、"64M"、"4096"的大小，失败或溢出返回-1 */
+off_t parse_size(const char *str) {
+    char *end;
+    long long val;
+    int shift = 0;
+
+    errno = 0;
+    val = strtoll(str, &end, 0);
+    if (end == str || val <= 0 || errno == ERANGE) {
+        return -1;
+    }
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0' || val > (LLONG_MAX >> shift)) {
+        return -1;
+    }
+    return val << shift;
+}
+
+/**
+ * 确定设备大小与扇区大小：环境变量DDRIVER_DISK_SZ / DDRIVER_BLOCK_SZ优先，
+ * 其次沿用镜像末尾记录的参数，都没有时使用编译时默认值（旧镜像即为此情形）
+ */
+int setup_geometry(int fd, off_t file_size) {
+    struct ddriver_meta meta;
+    off_t layout_size = CONFIG_DISK_SZ;
+    off_t iounit_size = CONFIG_BLOCK_SZ;
+    const char *env;
+
+    if (file_size >= CONFIG_META_SZ &&
+        pread(fd, &meta, sizeof(meta), file_size - CONFIG_META_SZ) == sizeof(meta) &&
+        meta.magic == CONFIG_META_MAGIC && meta.layout_size + CONFIG_META_SZ == file_size) {
+        layout_size = meta.layout_size;
+        iounit_size = meta.iounit_size;
+    }
+    if ((env = getenv("DDRIVER_DISK_SZ")) != NULL) {
+        layout_size = parse_size(env);
+    }
+    if ((env = getenv("DDRIVER_BLOCK_SZ")) != NULL) {
+        iounit_size = parse_size(env);
+    }
+
+    if (iounit_size < 512 || iounit_size > CONFIG_BLOCK_SZ_MAX || 
+        (iounit_size & (iounit_size - 1)) != 0) {
+        user_panic("bad block size %ld, should be a power of 2 in [512, %d]", 
+                   (long)iounit_size, CONFIG_BLOCK_SZ_MAX);
+        return -EINVAL;
+    }
+    if (layout_size < iounit_size || layout_size % iounit_size != 0) {
+        user_panic("bad disk size %ld, should be a multiple of block size %ld", 
+                   (long)layout_size, (long)iounit_size);
+        return -EINVAL;
+    }
+
+    disk.layout_size = layout_size;
+    disk.iounit_size = iounit_size;
+    return 0;
+}
+
+/* 在设备区之后写入设备参数 */
+int write_geometry(int fd) {
+    char buf[CONFIG_META_SZ] = {0};
+    struct ddriver_meta meta = {
+        .magic       = CONFIG_META_MAGIC,
+        .iounit_size = disk.iounit_size,
+        .layout_size = disk.layout_size
+    };
+
+    memcpy(buf, &meta, sizeof(meta));
+    if (pwrite(fd, buf, CONFIG_META_SZ, disk.layout_size) != CONFIG_META_SZ) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * mmap模式：设置环境变量DDRIVER_MMAP=1后，设备区在打开时整体映射，
+ * 读写变为memcpy，默认使用none延迟模型（计数照常），用于吞吐测试。
+ * 写入只进入页缓存，由IOC_REQ_DEVICE_SYNC或关闭设备时对脏范围msync落盘
+ */
+int map_setup(int fd) {
+    const char *env = getenv("DDRIVER_MMAP");
+    void *map;
+
+    if (env == NULL || strcmp(env, "1") != 0) {
         return 0;
     }
+    map = mmap(NULL, disk.layout_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        user_panic("mmap error: %s", strerror(errno));
+        return -errno;
+    }
+    disk.map       = map;
+    disk.map_pos   = 0;
+    disk.dirty_lo  = disk.dirty_hi = 0;
+    return 0;
+}
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
+void map_mark_dirty(off_t start, off_t end) {
+    pthread_mutex_lock(&disk.map_lock);
+    if (disk.dirty_lo >= disk.dirty_hi) {
+        disk.dirty_lo = start;
+        disk.dirty_hi = end;
+    }
+    else {
+        disk.dirty_lo = start < disk.dirty_lo ? start : disk.dirty_lo;
+        disk.dirty_hi = end > disk.dirty_hi ? end : disk.dirty_hi;
+    }
+    pthread_mutex_unlock(&disk.map_lock);
+}
+
+/* 将脏范围msync落盘，起点按页向下对齐 */
+int map_sync() {
+    long page = sysconf(_SC_PAGESIZE);
+    off_t lo, hi;
+
+    pthread_mutex_lock(&disk.map_lock);
+    lo = disk.dirty_lo;
+    hi = disk.dirty_hi;
+    disk.dirty_lo = disk.dirty_hi = 0;
+    pthread_mutex_unlock(&disk.map_lock);
+
+    if (lo >= hi) {
+        return 0;
+    }
+    lo = lo / page * page;
+    if (msync(disk.map + lo, hi - lo, MS_SYNC) < 0) {
+        user_panic("msync error: %s", strerror(errno));
+        return -errno;
+    }
     return 0;
 }
+
+/* mmap模式下在offset处读写total字节 */
+ssize_t map_copy(int op, const struct iovec *iov, int iovcnt, off_t offset, ssize_t total) {
+    char *pos = disk.map + offset;
+
+    if (offset < 0 || offset + total > disk.layout_size) {
+        user_alert("io [%ld, %ld) out of device", (long)offset, (long)(offset + total));
+        return -EIO;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (op == DDRIVER_AIO_WRITE)
+            memcpy(pos, iov[i].iov_base, iov[i].iov_len);
+        else
+            memcpy(iov[i].iov_base, pos, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    if (op == DDRIVER_AIO_WRITE) {
+        map_mark_dirty(offset, offset + total);
+    }
+    return total;
+}
+
+/* mmap模式下在当前位置读写并前移位置 */
+ssize_t map_copy_cur(int op, const struct iovec *iov, int iovcnt, ssize_t total) {
+    ssize_t ret = map_copy(op, iov, iovcnt, disk.map_pos, total);
+
+    if (ret > 0) {
+        disk.map_pos += ret;
+    }
+    return ret;
+}
+
+/* 记录一次磁头从cur到offset的移动 */
+void stat_seek(off_t cur, off_t offset) {
+    STAT_ADD(seek_cnt, 1);
+    STAT_ADD(seek_dist, labs(offset - cur));
+}
+
+/* 记录一个完成的请求：次数、字节数、累计延迟，以及延迟落入的直方图桶 */
+void stat_io(int op, size_t size, long long lat_ns) {
+    int bucket = lat_ns > 0 ? 64 - __builtin_clzll(lat_ns) : 0;
+
+    if (bucket >= DDRIVER_HIST_BUCKETS) {
+        bucket = DDRIVER_HIST_BUCKETS - 1;
+    }
+    if (op == DDRIVER_AIO_WRITE) {
+        STAT_ADD(write_cnt, 1);
+        STAT_ADD(write_bytes, size);
+        STAT_ADD(write_lat_ns, lat_ns);
+        STAT_ADD(write_hist[bucket], 1);
+    }
+    else {
+        STAT_ADD(read_cnt, 1);
+        STAT_ADD(read_bytes, size);
+        STAT_ADD(read_lat_ns, lat_ns);
+        STAT_ADD(read_hist[bucket], 1);
+    }
+}
+
+/**
+ * 选择延迟模型：环境变量DDRIVER_PROFILE=hdd|ssd|nvme|none，
+ * 未设置时mmap模式使用none，否则使用hdd
+ */
+int setup_profile() {
+    const char *name = getenv("DDRIVER_PROFILE");
+
+    if (name == NULL) {
+        name = disk.map ? "none" : "hdd";
+    }
+    for (size_t i = 0; i < sizeof(ddriver_profiles) / sizeof(ddriver_profiles[0]); i++) {
+        if (strcmp(ddriver_profiles[i].name, name) == 0) {
+            disk.profile = &ddriver_profiles[i];
+            memset(disk.chan_free_ns, 0, sizeof(disk.chan_free_ns));
+            return 0;
+        }
+    }
+    user_panic("unknown profile [%s], should be hdd / ssd / nvme / none", name);
+    return -EINVAL;
+}
+
+/* 单调时钟，单位ns */
+long long emulate_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* 等到deadline：先睡眠到差CONFIG_SPIN_NS处，剩下的忙等，精度不受睡眠粒度影响 */
+void emulate_wait_until(long long deadline) {
+    long long wake = deadline - CONFIG_SPIN_NS;
+
+    if (wake > emulate_now_ns()) {
+        struct timespec ts = { .tv_sec = wake / 1000000000LL, .tv_nsec = wake % 1000000000LL };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+    while (emulate_now_ns() < deadline)
+        ;
+}
+
+/* 磁头从start移动到end的旋转延迟，单位ns */
+long long emulate_rotate_ns(off_t start, off_t end) {
+    const struct ddriver_profile *prof = disk.profile;
+    off_t bytes_per_track = disk.layout_size / prof->track_num;
+    off_t distance;
+
+    if (prof->rotate_ns == 0 || bytes_per_track == 0) {
+        return 0;
+    }
+    distance = labs(end - start) % bytes_per_track;
+    return (long long)distance * prof->rotate_ns / bytes_per_track;
+}
+
+/* 请求的固定开销加上传输size字节的时间，单位ns */
+long long emulate_xfer_ns(int op, size_t size) {
+    const struct ddriver_profile *prof = disk.profile;
+    long long cost = op == DDRIVER_AIO_WRITE ? prof->write_ns : prof->read_ns;
+
+    if (prof->bandwidth_mbps > 0) {
+        cost += (long long)size * 1000 / prof->bandwidth_mbps;
+    }
+    return cost;
+}
+
+/**
+ * 在设备时间线上安排一个耗时cost的请求：占用最早空闲的通道，
+ * 返回模拟完成时刻。通道都忙时请求排在其后，体现队列深度超过并行度后的排队
+ */
+long long emulate_reserve(long long cost) {
+    long long now = emulate_now_ns();
+    long long start;
+    int best = 0;
+
+    if (cost <= 0) {
+        return now;
+    }
+    pthread_mutex_lock(&disk.time_lock);
+    for (int i = 1; i < disk.profile->channels; i++) {
+        if (disk.chan_free_ns[i] < disk.chan_free_ns[best])
+            best = i;
+    }
+    start = disk.chan_free_ns[best] > now ? disk.chan_free_ns[best] : now;
+    disk.chan_free_ns[best] = start + cost;
+    pthread_mutex_unlock(&disk.time_lock);
+    return start + cost;
+}
+
+/* 将模拟磁头移到offset，返回旋转延迟；磁头确实移动时计一次seek */
+long long emulate_head_move(off_t offset) {
+    off_t cur;
+
+    pthread_mutex_lock(&disk.head_lock);
+    cur = disk.head;
+    disk.head = offset;
+    pthread_mutex_unlock(&disk.head_lock);
+
+    if (cur == offset) {
+        return 0;
+    }
+    stat_seek(cur, offset);
+    return emulate_rotate_ns(cur, offset);
+}
+
+/**
+ * 同步I/O的模拟延迟：在设备时间线上占位并等到完成时刻
+ * 
+ * @param offset 请求位置，为-1时表示从当前磁头位置开始（不移动磁头）
+ * @return long long 请求的模拟延迟（ns），含在通道上排队的时间
+ */
+long long emulate_io(int op, off_t offset, size_t size) {
+    long long cost = (offset >= 0 ? emulate_head_move(offset) : 0) + emulate_xfer_ns(op, size);
+    long long now, done;
+
+    if (cost <= 0) {
+        return 0;
+    }
+    now = emulate_now_ns();
+    done = emulate_reserve(cost);
+    emulate_wait_until(done);
+    return done - now;
+}
+
+/* I/O完成后磁头停在请求末尾 */
+void emulate_head_forward(off_t end) {
+    pthread_mutex_lock(&disk.head_lock);
+    disk.head = end;
+    pthread_mutex_unlock(&disk.head_lock);
+}
+/******************************************************************************
+* SECTION: Asynchronous I/O Context
+*******************************************************************************/
+/**
+ * 异步I/O：真实读写交给io_uring（不可用时交给线程池）完成，
+ * 模拟延迟由一条虚拟设备时间线给出——每个请求提交时按磁头移动距离和读写延迟
+ * 排在设备上一个请求之后，得到模拟完成时间，请求到达该时间后才交付给调用者。
+ * 因此调用者可以在设备"忙"的同时继续做别的事，也可以一次提交一批请求。
+ * 同一时刻只应有一个线程提交和收割请求。
+ */
+struct ddriver_aio_uring
+{
+    int                  ring_fd;
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr, *cq_ptr;
+    size_t               sq_sz, cq_sz, sqes_sz;
+};
+
+struct ddriver_aio_pool
+{
+    pthread_t               workers[CONFIG_AIO_WORKERS];
+    int                     nworkers;                 /* 已启动的工作线程数 */
+    pthread_mutex_t         lock;
+    pthread_cond_t          sq_cond;                  /* 有新请求 */
+    pthread_cond_t          cq_cond;                  /* 有请求完成 */
+    struct ddriver_aio_req *sq_head, *sq_tail;        /* 待处理 */
+    struct ddriver_aio_req *cq_head;                  /* 已完成 */
+    int                     stop;
+};
+
+struct ddriver_aio
+{
+    int                     enabled;
+    int                     use_uring;
+    int                     use_map;                  /* mmap模式，派发时直接拷贝 */
+    int                     fd;
+    int                     depth;
+    int                     inflight;                 /* 已提交，真实I/O未完成 */
+    struct ddriver_aio_req *done;                     /* 真实I/O已完成，等待模拟完成时间 */
+    struct ddriver_aio_uring uring;
+    struct ddriver_aio_pool  pool;
+};
+
+struct ddriver_aio aio = {
+    .enabled = 0
+};
+/******************************************************************************
+* SECTION: I/O Scheduler
+*******************************************************************************/
+/**
+ * 异步请求先进入调度队列，派发时按策略挑选下一个请求，并把队列中与之扇区相邻、
+ * 方向相同的请求合并成一个向量I/O。请求排队期间deadline_ns记录入队时刻。
+ * seek_dist_fifo按到达顺序累计磁头移动距离，作为比较调度效果的基线。
+ */
+struct ddriver_sched
+{
+    int                     policy;
+    struct ddriver_aio_req *head, *tail;              /* 未派发请求，按到达顺序 */
+    int                     queued;
+    off_t                   fifo_pos;                 /* 按到达顺序服务时的磁头位置 */
+    long long               dispatch_cnt;
+    long long               merge_cnt;
+    long long               seek_dist;
+    long long               seek_dist_fifo;
+};
+
+/* 合并后的请求，req.priv指向自身以便完成时识别 */
+struct ddriver_sched_merge
+{
+    struct ddriver_aio_req  req;
+    struct ddriver_aio_req *children;                 /* 被合并的原请求，按offset升序 */
+    ssize_t                 total;
+    struct iovec            iov[];
+};
+
+struct ddriver_sched sched = {
+    .policy = DDRIVER_SCHED_NOOP
+};
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
  * @brief 打开驱动
  * 
+ * 设备大小与扇区大小见setup_geometry，延迟模型见setup_profile，例如
+ * DDRIVER_DISK_SZ=1G DDRIVER_BLOCK_SZ=4096 DDRIVER_PROFILE=nvme 创建1GB、4KB扇区的NVMe设备。
+ * DDRIVER_DISK_SZ小于已有镜像时拒绝打开，以免截掉数据；
+ * 同时设置DDRIVER_FORMAT=1表示重新格式化，镜像清零后按新大小重建
+ * 
  * @return int 文件描述符
  */
 int ddriver_open(char *path) {
-    int fd, ret = 0;
+    int fd, ret = 0, format;
+    const char *env;
     char device_path[128] = {0};
     char log_path[128] = {0};
+    struct stat st;
     
     sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
     sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
@@ -147,9 +611,54 @@ int ddriver_open(char *path) {
         user_panic("can't open device: %d", fd);
         return fd;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
+    if (fstat(fd, &st) < 0) {
+        user_panic("can't stat device: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    ret = setup_geometry(fd, st.st_size);
     if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+
+    /* 镜像大小 = 设备大小 + 参数区；设备变小会截掉数据，只在明确要求重新格式化时进行 */
+    format = (env = getenv("DDRIVER_FORMAT")) != NULL && strcmp(env, "1") == 0;
+    if (!format && st.st_size > disk.layout_size + CONFIG_META_SZ) {
+        user_panic("device image is %ld bytes, disk size %ld would truncate it, "
+                   "set DDRIVER_FORMAT=1 to reformat", 
+                   (long)st.st_size, (long)disk.layout_size);
+        close(fd);
+        return -EINVAL;
+    }
+    if (format && ftruncate(fd, 0) < 0) {
+        user_panic("can't reformat device: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    ret = posix_fallocate(fd, 0, disk.layout_size + CONFIG_META_SZ);
+    if (ret != 0) {
         user_panic("low space");
+        close(fd);
+        return -ret;
+    }
+    if (write_geometry(fd) < 0) {
+        user_panic("can't write device geometry");
+        close(fd);
+        return -1;
+    }
+    ret = map_setup(fd);
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+    ret = setup_profile();
+    if (ret < 0) {
+        if (disk.map) {
+            munmap(disk.map, disk.layout_size);
+            disk.map = NULL;
+        }
+        close(fd);
         return ret;
     }
 
@@ -168,6 +677,15 @@ int ddriver_open(char *path) {
  * @return int 
  */
 int ddriver_close(int fd) {
+    ddriver_aio_destroy(fd);
+    if (disk.map) {
+        if (disk.map_pins > 0) {
+            user_alert("%d blocks still mapped on close", disk.map_pins);
+        }
+        map_sync();
+        munmap(disk.map, disk.layout_size);
+        disk.map = NULL;
+    }
     return close(fd) && fclose(debugf);
 }
 /**
@@ -176,26 +694,39 @@ int ddriver_close(int fd) {
  * @param fd 
  * @param offset 
  * @param whence 
- * @return int 
+ * @return off_t 移动后的磁头位置，2GB 以上的镜像同样不会截断；出错返回负的错误码
  */
-int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+off_t ddriver_seek(int fd, off_t offset, int whence){
+    off_t ret = 0;
+    off_t cur = 0;
 
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk.iounit_size);
         return -EINVAL;
     }
 
-    INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
+    if (disk.map) {
+        ret = offset + (whence == SEEK_CUR ? disk.map_pos : whence == SEEK_END ? disk.layout_size : 0);
+        if (ret < 0 || ret > disk.layout_size) {
+            user_alert("seek to %ld out of device", (long)ret);
+            return -EINVAL;
+        }
+        disk.map_pos = ret;
+    }
+    else {
+        ret = lseek(fd, offset, whence);
+    }
     if (ret < 0) {
         user_panic("seek error: %s", strerror(errno));
         return ret;
     }
-    emulate_rotate(fd, cur, ret);
+    pthread_mutex_lock(&disk.head_lock);
+    cur = disk.head;
+    disk.head = ret;
+    pthread_mutex_unlock(&disk.head_lock);
+    stat_seek(cur, ret);
+    emulate_wait_until(emulate_reserve(emulate_rotate_ns(cur, ret)));
     return ret;
 }
 /**
@@ -211,11 +742,21 @@ int ddriver_write(int fd, char *buf, size_t size){
     if(res < 0)
         return res;
         
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
+    long long lat = emulate_io(DDRIVER_AIO_WRITE, -1, size);
+    if (disk.map) {
+        struct iovec iov = { .iov_base = buf, .iov_len = size };
+        res = map_copy_cur(DDRIVER_AIO_WRITE, &iov, 1, size);
+        if (res < 0)
+            return res;
+        emulate_head_forward(disk.map_pos);
+    }
+    else {
+        write(fd, buf, size);
+        emulate_head_forward(lseek(fd, 0, SEEK_CUR));
+    }
 
-    INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    stat_io(DDRIVER_AIO_WRITE, size, lat);
+    return disk.iounit_size;
 }
 /**
  * @brief 
@@ -230,11 +771,233 @@ int ddriver_read(int fd, char *buf, size_t size){
     if(res < 0)
         return res;
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    long long lat = emulate_io(DDRIVER_AIO_READ, -1, size);
+    if (disk.map) {
+        struct iovec iov = { .iov_base = buf, .iov_len = size };
+        res = map_copy_cur(DDRIVER_AIO_READ, &iov, 1, size);
+        if (res < 0)
+            return res;
+        emulate_head_forward(disk.map_pos);
+    }
+    else {
+        read(fd, buf, size);
+        emulate_head_forward(lseek(fd, 0, SEEK_CUR));
+    }
+
+    stat_io(DDRIVER_AIO_READ, size, lat);
+    return disk.iounit_size;
+}
+/**
+ * @brief 向量读，从当前磁头位置读出N个扇区，整个请求只计一次读延迟
+ * 
+ * @param fd 
+ * @param iov 每段长度须为设备IO单位的整数倍
+ * @param iovcnt 
+ * @return int 读出的字节数
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt){
+    ssize_t total = check_valid_iov(iov, iovcnt);
+    if (total < 0)
+        return total;
+
+    long long lat = emulate_io(DDRIVER_AIO_READ, -1, total);
+    if (disk.map) {
+        if (map_copy_cur(DDRIVER_AIO_READ, iov, iovcnt, total) < 0)
+            return -EIO;
+        emulate_head_forward(disk.map_pos);
+    }
+    else {
+        if (readv(fd, iov, iovcnt) != total) {
+            user_panic("readv error: %s", strerror(errno));
+            return -EIO;
+        }
+        emulate_head_forward(lseek(fd, 0, SEEK_CUR));
+    }
+
+    stat_io(DDRIVER_AIO_READ, total, lat);
+    return total;
+}
+/**
+ * @brief 向量写，从当前磁头位置写入N个扇区，整个请求只计一次写延迟
+ * 
+ * @param fd 
+ * @param iov 每段长度须为设备IO单位的整数倍
+ * @param iovcnt 
+ * @return int 写入的字节数
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt){
+    ssize_t total = check_valid_iov(iov, iovcnt);
+    if (total < 0)
+        return total;
 
-    INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    long long lat = emulate_io(DDRIVER_AIO_WRITE, -1, total);
+    if (disk.map) {
+        if (map_copy_cur(DDRIVER_AIO_WRITE, iov, iovcnt, total) < 0)
+            return -EIO;
+        emulate_head_forward(disk.map_pos);
+    }
+    else {
+        if (writev(fd, iov, iovcnt) != total) {
+            user_panic("writev error: %s", strerror(errno));
+            return -EIO;
+        }
+        emulate_head_forward(lseek(fd, 0, SEEK_CUR));
+    }
+
+    stat_io(DDRIVER_AIO_WRITE, total, lat);
+    return total;
+}
+/**
+ * @brief 在offset处向量读，不改变fd的文件位置
+ * 
+ * 磁头从上一次I/O结束处移动到offset，按延迟模型模拟旋转延迟、固定开销与传输时间
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @param offset 须与设备IO单位对齐
+ * @return int 读出的字节数
+ */
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    ssize_t total = check_valid_iov(iov, iovcnt);
+    if (total < 0)
+        return total;
+    if (!IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+
+    long long lat = emulate_io(DDRIVER_AIO_READ, offset, total);
+    if (disk.map) {
+        if (map_copy(DDRIVER_AIO_READ, iov, iovcnt, offset, total) < 0)
+            return -EIO;
+    }
+    else if (preadv(fd, iov, iovcnt, offset) != total) {
+        user_panic("preadv error: %s", strerror(errno));
+        return -EIO;
+    }
+    emulate_head_forward(offset + total);
+
+    stat_io(DDRIVER_AIO_READ, total, lat);
+    return total;
+}
+/**
+ * @brief 在offset处向量写，不改变fd的文件位置
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @param offset 须与设备IO单位对齐
+ * @return int 写入的字节数
+ */
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    ssize_t total = check_valid_iov(iov, iovcnt);
+    if (total < 0)
+        return total;
+    if (!IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                      offset, disk.iounit_size);
+        return -EINVAL;
+    }
+
+    long long lat = emulate_io(DDRIVER_AIO_WRITE, offset, total);
+    if (disk.map) {
+        if (map_copy(DDRIVER_AIO_WRITE, iov, iovcnt, offset, total) < 0)
+            return -EIO;
+    }
+    else if (pwritev(fd, iov, iovcnt, offset) != total) {
+        user_panic("pwritev error: %s", strerror(errno));
+        return -EIO;
+    }
+    emulate_head_forward(offset + total);
+
+    stat_io(DDRIVER_AIO_WRITE, total, lat);
+    return total;
+}
+/**
+ * @brief 位置读，不改变fd的文件位置，可被多个线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 设备IO单位的整数倍
+ * @param offset 须与设备IO单位对齐
+ * @return int 读出的字节数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    return ddriver_preadv(fd, &iov, 1, offset);
+}
+/**
+ * @brief 位置写，不改变fd的文件位置，可被多个线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size 设备IO单位的整数倍
+ * @param offset 须与设备IO单位对齐
+ * @return int 写入的字节数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    return ddriver_pwritev(fd, &iov, 1, offset);
+}
+/**
+ * @brief 钉住一段设备内容，返回直接指向设备映像的指针，不经过任何拷贝
+ * 
+ * 只有mmap模式可用，其他模式返回NULL，调用者应退回ddriver_pread等拷贝接口。
+ * 指针在ddriver_unmap_block之前一直有效，可以在其上就地解析或修改；
+ * 以DDRIVER_MAP_READ映射时计一次读，DDRIVER_MAP_WRITE表示调用者会覆盖整段，
+ * 不需要旧内容，只模拟写的延迟，写本身在ddriver_unmap_block时计入
+ * 
+ * @param fd 
+ * @param offset 须与设备IO单位对齐
+ * @param size 设备IO单位的整数倍
+ * @param access DDRIVER_MAP_READ / DDRIVER_MAP_WRITE
+ * @return void* 设备内容，不可用时返回NULL
+ */
+void *ddriver_map_block(int fd, off_t offset, size_t size, int access) {
+    IGNORE_ARG(fd);
+    if (disk.map == NULL) {
+        return NULL;
+    }
+    if (size == 0 || !IS_ADDR_ALIGN(offset) || !IS_ADDR_ALIGN(size) ||
+        offset < 0 || offset + (off_t)size > disk.layout_size) {
+        user_alert("can't map [%ld, %ld)", (long)offset, (long)(offset + size));
+        return NULL;
+    }
+
+    if (access == DDRIVER_MAP_WRITE) {
+        emulate_io(DDRIVER_AIO_WRITE, offset, size);
+    }
+    else {
+        stat_io(DDRIVER_AIO_READ, size, emulate_io(DDRIVER_AIO_READ, offset, size));
+    }
+    emulate_head_forward(offset + size);
+    __atomic_fetch_add(&disk.map_pins, 1, __ATOMIC_RELAXED);
+    return disk.map + offset;
+}
+/**
+ * @brief 解除ddriver_map_block的映射
+ * 
+ * @param fd 
+ * @param addr ddriver_map_block返回的指针
+ * @param size 与映射时相同
+ * @param dirty 映射期间是否修改过内容，修改过的范围计一次写，并在同步时msync
+ * @return int 0成功，否则失败
+ */
+int ddriver_unmap_block(int fd, void *addr, size_t size, int dirty) {
+    off_t offset = (char *)addr - disk.map;
+
+    IGNORE_ARG(fd);
+    if (disk.map == NULL || offset < 0 || offset + (off_t)size > disk.layout_size) {
+        return -EINVAL;
+    }
+    if (dirty) {
+        map_mark_dirty(offset, offset + size);
+        stat_io(DDRIVER_AIO_WRITE, size, 0);
+    }
+    __atomic_fetch_sub(&disk.map_pins, 1, __ATOMIC_RELAXED);
+    return 0;
 }
 /**
  * @brief 
@@ -246,34 +1009,753 @@ int ddriver_read(int fd, char *buf, size_t size){
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
     struct ddriver_state state;
+    struct ddriver_sched_state sched_state;
+    int layout_size;
+    long long layout_size64;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+        /* 协议中大小为int，超过2GB的设备只报告前INT_MAX字节（按扇区向下取整），完整大小见IOC_REQ_DEVICE_SIZE64 */
+        layout_size = disk.layout_size > INT_MAX ? ADDR_ROUND_UP((off_t)INT_MAX) : disk.layout_size;
+        memcpy(arg, &layout_size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_SIZE64:                       /* Device Size (64-bit) */
+        layout_size64 = disk.layout_size;
+        memcpy(arg, &layout_size64, sizeof(long long));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        state.read_cnt = disk.stat.read_cnt;
+        state.write_cnt = disk.stat.write_cnt;
+        state.seek_cnt = disk.stat.seek_cnt;
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
+    case IOC_REQ_DEVICE_STAT64:                       /* 64-bit Device Statistics */
+        memcpy(arg, &disk.stat, sizeof(struct ddriver_stat64));
+        break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
-        }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        if (disk.map) {
+            memset(disk.map, 0, disk.layout_size);
+            map_mark_dirty(0, disk.layout_size);
+            disk.map_pos = 0;
+        }
+        else {
+            lseek(fd, 0, SEEK_SET);
+            char buf[4096] = {'\0'};
+            for (off_t i = 0; i < disk.layout_size; i += 4096)
+            {
+                /* 只清空设备区，保留末尾的设备参数 */
+                write(fd, buf, disk.layout_size - i < 4096 ? disk.layout_size - i : 4096);
+            }
+            lseek(fd, 0, SEEK_SET);
+        }
+        emulate_head_forward(0);
+        memset(&disk.stat, 0, sizeof(struct ddriver_stat64));
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         memcpy(arg, &disk.iounit_size, sizeof(int));
         break;
+    case IOC_REQ_DEVICE_SYNC:                         /* Sync Device */
+        if (disk.map)
+            return map_sync();
+        if (fdatasync(fd) < 0)
+            return -errno;
+        break;
+    case IOC_SET_SCHED_POLICY:                        /* Scheduler Policy */
+        if (*(int *)arg < DDRIVER_SCHED_NOOP || *(int *)arg > DDRIVER_SCHED_DEADLINE) {
+            return -EINVAL;
+        }
+        sched.policy = *(int *)arg;
+        break;
+    case IOC_REQ_SCHED_STATE:                         /* Scheduler State */
+        sched_state.policy = sched.policy;
+        sched_state.queued = sched.queued;
+        sched_state.dispatch_cnt = sched.dispatch_cnt;
+        sched_state.merge_cnt = sched.merge_cnt;
+        sched_state.seek_dist = sched.seek_dist;
+        sched_state.seek_dist_fifo = sched.seek_dist_fifo;
+        memcpy(arg, &sched_state, sizeof(struct ddriver_sched_state));
+        break;
     default:
         break;
     }
     return 0;
-}
\ No newline at end of file
+}
+/******************************************************************************
+* SECTION: Asynchronous I/O Implementation
+*******************************************************************************/
+static ssize_t aio_req_size(const struct ddriver_aio_req *req) {
+    ssize_t total = 0;
+    for (int i = 0; i < req->iovcnt; i++) {
+        total += req->iov[i].iov_len;
+    }
+    return total;
+}
+
+/* 真实I/O完成：合并请求拆回原请求，放入待交付链表 */
+static void aio_complete(struct ddriver_aio_req *req) {
+    aio.inflight--;
+    if (req->priv == req) {
+        struct ddriver_sched_merge *merge = (struct ddriver_sched_merge *)req;
+        struct ddriver_aio_req *child = merge->children, *next;
+
+        while (child) {
+            next = child->next;
+            if (req->res < 0)
+                child->res = req->res;
+            else if (req->res == merge->total)
+                child->res = aio_req_size(child);
+            else
+                child->res = -EIO;
+            child->deadline_ns = req->deadline_ns;
+            child->next = aio.done;
+            aio.done = child;
+            child = next;
+        }
+        free(merge);
+        return;
+    }
+    req->next = aio.done;
+    aio.done  = req;
+}
+
+static int aio_uring_setup(int depth) {
+    struct ddriver_aio_uring *ring = &aio.uring;
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->ring_fd < 0) {
+        return -errno;
+    }
+
+    ring->sq_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_sz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_sz > ring->sq_sz)
+            ring->sq_sz = ring->cq_sz;
+        ring->cq_sz = ring->sq_sz;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->ring_fd);
+        return -ENOMEM;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_sz);
+            close(ring->ring_fd);
+            return -ENOMEM;
+        }
+    }
+
+    ring->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr)
+            munmap(ring->cq_ptr, ring->cq_sz);
+        munmap(ring->sq_ptr, ring->sq_sz);
+        close(ring->ring_fd);
+        return -ENOMEM;
+    }
+
+    ring->sq_head  = (unsigned *)((char *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail  = (unsigned *)((char *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask  = (unsigned *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + params.sq_off.array);
+    ring->cq_head  = (unsigned *)((char *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail  = (unsigned *)((char *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask  = (unsigned *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+    return 0;
+}
+
+static void aio_uring_destroy() {
+    struct ddriver_aio_uring *ring = &aio.uring;
+
+    munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_sz);
+    munmap(ring->sq_ptr, ring->sq_sz);
+    close(ring->ring_fd);
+}
+
+static void aio_uring_queue(struct ddriver_aio_req *req) {
+    struct ddriver_aio_uring *ring = &aio.uring;
+    unsigned tail = *ring->sq_tail;
+    unsigned idx  = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = req->op == DDRIVER_AIO_WRITE ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd        = aio.fd;
+    sqe->addr      = (unsigned long)req->iov;
+    sqe->len       = req->iovcnt;
+    sqe->off       = req->offset;
+    sqe->user_data = (unsigned long)req;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int aio_uring_reap(int wait);
+
+/*
+ * 把SQ环中排队的cnt个请求交给内核。EINTR时重试，EAGAIN/EBUSY时先收割完成队列再重试。
+ * 仍然失败时收回内核没有取走的SQE，把对应请求以-errno完成，调用者照常取回这些请求，
+ * 提交方释放请求内存之后内核不会再访问它们
+ */
+static void aio_uring_submit(int cnt) {
+    struct ddriver_aio_uring *ring = &aio.uring;
+    int retry = 0, err = 0;
+
+    while (cnt > 0) {
+        int ret = syscall(__NR_io_uring_enter, ring->ring_fd, cnt, 0, 0, NULL, 0);
+
+        if (ret >= 0) {
+            cnt -= ret;
+            continue;
+        }
+        err = errno;
+        if (err == EINTR) {
+            continue;
+        }
+        if ((err == EAGAIN || err == EBUSY) && retry++ < CONFIG_AIO_ENTER_RETRY) {
+            aio_uring_reap(0);
+            continue;
+        }
+        break;
+    }
+    if (cnt == 0) {
+        return;
+    }
+
+    user_panic("io_uring_enter error: %s", strerror(err));
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    for (; head != tail; head++) {
+        struct io_uring_sqe *sqe = &ring->sqes[ring->sq_array[head & *ring->sq_mask]];
+        struct ddriver_aio_req *req = (struct ddriver_aio_req *)(unsigned long)sqe->user_data;
+
+        req->res = -err;
+        aio_complete(req);
+    }
+}
+
+/* 收割io_uring完成队列，wait为真时至少等到一个完成 */
+static int aio_uring_reap(int wait) {
+    struct ddriver_aio_uring *ring = &aio.uring;
+    unsigned head;
+    int reaped = 0;
+
+    if (wait) {
+        if (syscall(__NR_io_uring_enter, ring->ring_fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+            return -errno;
+        }
+    }
+
+    head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct ddriver_aio_req *req = (struct ddriver_aio_req *)(unsigned long)cqe->user_data;
+
+        req->res  = cqe->res;
+        aio_complete(req);
+        reaped++;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+static void *aio_pool_worker(void *arg) {
+    struct ddriver_aio_pool *pool = &aio.pool;
+    struct ddriver_aio_req *req;
+    IGNORE_ARG(arg);
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->sq_head == NULL && !pool->stop) {
+            pthread_cond_wait(&pool->sq_cond, &pool->lock);
+        }
+        if (pool->sq_head == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        req = pool->sq_head;
+        pool->sq_head = req->next;
+        if (pool->sq_head == NULL)
+            pool->sq_tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (req->op == DDRIVER_AIO_WRITE)
+            req->res = pwritev(aio.fd, req->iov, req->iovcnt, req->offset);
+        else
+            req->res = preadv(aio.fd, req->iov, req->iovcnt, req->offset);
+        if (req->res < 0)
+            req->res = -errno;
+
+        pthread_mutex_lock(&pool->lock);
+        req->next = pool->cq_head;
+        pool->cq_head = req;
+        pthread_cond_signal(&pool->cq_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static int aio_pool_setup() {
+    struct ddriver_aio_pool *pool = &aio.pool;
+
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->sq_cond, NULL);
+    pthread_cond_init(&pool->cq_cond, NULL);
+    for (int i = 0; i < CONFIG_AIO_WORKERS; i++) {
+        if (pthread_create(&pool->workers[i], NULL, aio_pool_worker, NULL) != 0) {
+            return -EAGAIN;
+        }
+        pool->nworkers++;
+    }
+    return 0;
+}
+
+static void aio_pool_destroy() {
+    struct ddriver_aio_pool *pool = &aio.pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->sq_cond);
+    pthread_mutex_unlock(&pool->lock);
+    /* 部分启动失败时只回收已创建的线程 */
+    for (int i = 0; i < pool->nworkers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pool->nworkers = 0;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->sq_cond);
+    pthread_cond_destroy(&pool->cq_cond);
+}
+
+static void aio_pool_queue(struct ddriver_aio_req *req) {
+    struct ddriver_aio_pool *pool = &aio.pool;
+
+    req->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->sq_tail)
+        pool->sq_tail->next = req;
+    else
+        pool->sq_head = req;
+    pool->sq_tail = req;
+    pthread_cond_signal(&pool->sq_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int aio_pool_reap(int wait) {
+    struct ddriver_aio_pool *pool = &aio.pool;
+    struct ddriver_aio_req *req;
+    int reaped = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (wait && pool->cq_head == NULL) {
+        pthread_cond_wait(&pool->cq_cond, &pool->lock);
+    }
+    while (pool->cq_head) {
+        req = pool->cq_head;
+        pool->cq_head = req->next;
+        aio_complete(req);
+        reaped++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return reaped;
+}
+
+/* 交付已到达模拟完成时间的请求 */
+static int aio_deliver(struct ddriver_aio_req **out, int max) {
+    struct ddriver_aio_req **link = &aio.done;
+    long long now = emulate_now_ns();
+    int got = 0;
+
+    while (*link && got < max) {
+        struct ddriver_aio_req *req = *link;
+        if (req->deadline_ns <= now) {
+            *link = req->next;
+            req->next = NULL;
+            out[got++] = req;
+        }
+        else {
+            link = &req->next;
+        }
+    }
+    return got;
+}
+
+/* 按延迟模型计算请求在虚拟设备时间线上的完成时刻，并完成统计 */
+static void aio_schedule(struct ddriver_aio_req *req, size_t size) {
+    long long now = emulate_now_ns();
+    long long cost;
+    off_t cur;
+
+    pthread_mutex_lock(&disk.head_lock);
+    cur = disk.head;
+    disk.head = req->offset + size;
+    pthread_mutex_unlock(&disk.head_lock);
+
+    sched.seek_dist += labs(req->offset - cur);
+    cost = emulate_rotate_ns(cur, req->offset) + emulate_xfer_ns(req->op, size);
+    if (cur != req->offset)
+        stat_seek(cur, req->offset);
+    req->deadline_ns = emulate_reserve(cost);
+    stat_io(req->op, size, cost > 0 ? req->deadline_ns - now : 0);
+}
+/* 入队，同时按到达顺序累计基线磁头移动距离 */
+static void sched_enqueue(struct ddriver_aio_req *req, ssize_t size) {
+    if (sched.queued == 0 && aio.inflight == 0) {
+        pthread_mutex_lock(&disk.head_lock);
+        sched.fifo_pos = disk.head;
+        pthread_mutex_unlock(&disk.head_lock);
+    }
+    sched.seek_dist_fifo += labs(req->offset - sched.fifo_pos);
+    sched.fifo_pos = req->offset + size;
+
+    req->res  = 0;
+    req->next = NULL;
+    req->deadline_ns = emulate_now_ns();
+    if (sched.tail)
+        sched.tail->next = req;
+    else
+        sched.head = req;
+    sched.tail = req;
+    sched.queued++;
+}
+
+static void sched_unlink(struct ddriver_aio_req *req) {
+    struct ddriver_aio_req **link = &sched.head, *prev = NULL;
+
+    while (*link != req) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    *link = req->next;
+    if (sched.tail == req)
+        sched.tail = prev;
+    req->next = NULL;
+    sched.queued--;
+}
+
+/* C-LOOK：取磁头位置之后offset最小的请求，没有则回绕到offset最小的请求 */
+static struct ddriver_aio_req *sched_pick_clook() {
+    struct ddriver_aio_req *req, *ahead = NULL, *lowest = NULL;
+    off_t pos;
+
+    pthread_mutex_lock(&disk.head_lock);
+    pos = disk.head;
+    pthread_mutex_unlock(&disk.head_lock);
+
+    for (req = sched.head; req; req = req->next) {
+        if (req->offset >= pos && (ahead == NULL || req->offset < ahead->offset))
+            ahead = req;
+        if (lowest == NULL || req->offset < lowest->offset)
+            lowest = req;
+    }
+    return ahead ? ahead : lowest;
+}
+
+static struct ddriver_aio_req *sched_pick() {
+    struct ddriver_aio_req *oldest = sched.head;
+    long long expire;
+
+    switch (sched.policy)
+    {
+    case DDRIVER_SCHED_CLOOK:
+        return sched_pick_clook();
+    case DDRIVER_SCHED_DEADLINE:
+        expire = oldest->op == DDRIVER_AIO_WRITE ? CONFIG_SCHED_WRITE_EXPIRE_US 
+                                                 : CONFIG_SCHED_READ_EXPIRE_US;
+        if (emulate_now_ns() - oldest->deadline_ns >= expire * 1000)
+            return oldest;
+        return sched_pick_clook();
+    default:
+        return oldest;
+    }
+}
+
+/* 把队列中与req首尾相接、方向相同的请求合并进来，无可合并时原样返回 */
+static struct ddriver_aio_req *sched_merge(struct ddriver_aio_req *req) {
+    struct ddriver_sched_merge *merge;
+    struct ddriver_aio_req *cur, *first = req, *last = req;
+    off_t start = req->offset;
+    off_t end = req->offset + aio_req_size(req);
+    int iovcnt = req->iovcnt, nr = 1, found = 1;
+
+    /* 先在队列中就地串起可合并的请求，暂不出队 */
+    req->next = NULL;
+    while (found) {
+        found = 0;
+        for (cur = sched.head; cur; cur = cur->next) {
+            if (cur == req || cur->op != req->op || iovcnt + cur->iovcnt > CONFIG_IOV_MAX)
+                continue;
+            if (cur->offset == end || cur->offset + aio_req_size(cur) == start) {
+                found = 1;
+                break;
+            }
+        }
+        if (!found)
+            break;
+        sched_unlink(cur);
+        if (cur->offset == end) {
+            last->next = cur;
+            last = cur;
+            end += aio_req_size(cur);
+        }
+        else {
+            cur->next = first;
+            first = cur;
+            start = cur->offset;
+        }
+        iovcnt += cur->iovcnt;
+        nr++;
+    }
+    if (nr == 1)
+        return req;
+
+    merge = (struct ddriver_sched_merge *)malloc(sizeof(struct ddriver_sched_merge) 
+                                                 + iovcnt * sizeof(struct iovec));
+    if (merge == NULL) {                              /* 放回队列，本次只派发req */
+        for (cur = first; cur; cur = first) {
+            first = cur->next;
+            if (cur == req)
+                continue;
+            cur->next = NULL;
+            if (sched.tail)
+                sched.tail->next = cur;
+            else
+                sched.head = cur;
+            sched.tail = cur;
+            sched.queued++;
+        }
+        req->next = NULL;
+        return req;
+    }
+
+    memset(&merge->req, 0, sizeof(merge->req));
+    merge->req.op     = req->op;
+    merge->req.offset = start;
+    merge->req.iov    = merge->iov;
+    merge->req.iovcnt = iovcnt;
+    merge->req.priv   = &merge->req;
+    merge->children   = first;
+    merge->total      = end - start;
+    iovcnt = 0;
+    for (cur = first; cur; cur = cur->next) {
+        memcpy(merge->iov + iovcnt, cur->iov, cur->iovcnt * sizeof(struct iovec));
+        iovcnt += cur->iovcnt;
+    }
+    sched.merge_cnt += nr - 1;
+    return &merge->req;
+}
+
+/* 在队列深度允许的范围内按调度策略派发请求 */
+static int aio_dispatch() {
+    int dispatched = 0;
+
+    while (sched.queued > 0 && aio.inflight < aio.depth) {
+        struct ddriver_aio_req *req = sched_pick();
+
+        sched_unlink(req);
+        req = sched_merge(req);
+        aio_schedule(req, aio_req_size(req));
+        aio.inflight++;
+        if (aio.use_map) {
+            /* mmap模式直接拷贝，真实I/O即刻完成，仍按模拟完成时间交付 */
+            req->res = map_copy(req->op, req->iov, req->iovcnt, req->offset, aio_req_size(req));
+            aio_complete(req);
+        }
+        else if (aio.use_uring)
+            aio_uring_queue(req);
+        else
+            aio_pool_queue(req);
+        sched.dispatch_cnt++;
+        dispatched++;
+    }
+
+    if (aio.use_uring && dispatched > 0) {
+        aio_uring_submit(dispatched);
+    }
+    return dispatched;
+}
+
+/* 收割完成的请求并用空出的队列深度继续派发，收割失败返回负的errno */
+static int aio_reap(int wait) {
+    int reaped = 0;
+
+    if (aio.inflight > 0) {
+        reaped = aio.use_uring ? aio_uring_reap(wait) : aio_pool_reap(wait);
+    }
+    aio_dispatch();
+    return reaped;
+}
+/**
+ * @brief 初始化异步I/O，优先使用io_uring，不可用时退化为线程池
+ * 
+ * @param fd 
+ * @param depth 最多同时在途的请求数
+ * @return int 0成功，否则失败
+ */
+int ddriver_aio_setup(int fd, int depth) {
+    if (aio.enabled) {
+        return 0;
+    }
+    if (depth <= 0) {
+        return -EINVAL;
+    }
+
+    memset(&aio, 0, sizeof(aio));
+    sched.head   = sched.tail = NULL;
+    sched.queued = 0;
+    aio.fd    = fd;
+    aio.depth = depth;
+    if (disk.map) {
+        aio.use_map = 1;
+    }
+    else if (aio_uring_setup(depth) == 0) {
+        aio.use_uring = 1;
+    }
+    else {
+        user_alert("io_uring unavailable, fall back to thread pool");
+        if (aio_pool_setup() < 0) {
+            aio_pool_destroy();
+            return -EAGAIN;
+        }
+    }
+    aio.enabled = 1;
+    return 0;
+}
+/**
+ * @brief 提交一批异步请求
+ * 
+ * 请求先全部进入调度队列，再按调度策略排序、合并后派发，因此同一批请求可以被重排
+ * 
+ * @param fd 
+ * @param reqs 请求数组，请求在完成并被取回前不能释放
+ * @param nr 
+ * @return int 进入调度队列的请求数（受调度队列长度限制），负数失败
+ */
+int ddriver_aio_submit(int fd, struct ddriver_aio_req **reqs, int nr) {
+    int submitted = 0;
+    IGNORE_ARG(fd);
+
+    if (!aio.enabled) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < nr && sched.queued < CONFIG_SCHED_QUEUE_MAX; i++) {
+        struct ddriver_aio_req *req = reqs[i];
+        ssize_t total = check_valid_iov(req->iov, req->iovcnt);
+
+        if (total < 0 || !IS_ADDR_ALIGN(req->offset)) {
+            if (submitted == 0)
+                return total < 0 ? total : -EINVAL;
+            break;
+        }
+        sched_enqueue(req, total);
+        submitted++;
+    }
+
+    /* 派发失败的请求以负的res完成，仍由ddriver_aio_wait/poll取回 */
+    aio_dispatch();
+    return submitted;
+}
+/**
+ * @brief 取回已完成的请求，不阻塞
+ * 
+ * @param fd 
+ * @param done 输出已完成的请求
+ * @param max done数组大小
+ * @return int 取回的请求数
+ */
+int ddriver_aio_poll(int fd, struct ddriver_aio_req **done, int max) {
+    IGNORE_ARG(fd);
+    if (!aio.enabled) {
+        return -EINVAL;
+    }
+    aio_reap(0);
+    return aio_deliver(done, max);
+}
+/**
+ * @brief 等待至少min_nr个请求完成
+ * 
+ * @param fd 
+ * @param done 输出已完成的请求
+ * @param min_nr 至少等待的请求数（超过在途请求数时按在途数计）
+ * @param max done数组大小
+ * @return int 取回的请求数；一个都没取回时等待失败返回负的errno
+ */
+int ddriver_aio_wait(int fd, struct ddriver_aio_req **done, int min_nr, int max) {
+    int got = 0;
+    IGNORE_ARG(fd);
+
+    if (!aio.enabled) {
+        return -EINVAL;
+    }
+
+    while (got < max) {
+        struct ddriver_aio_req *req;
+        long long next = 0;
+        int pending = 0;
+
+        aio_reap(0);
+        got += aio_deliver(done + got, max - got);
+        for (req = aio.done; req; req = req->next) {
+            if (next == 0 || req->deadline_ns < next)
+                next = req->deadline_ns;
+            pending++;
+        }
+        if (got >= min_nr || pending + aio.inflight + sched.queued == 0) {
+            break;
+        }
+
+        if (pending > 0) {                            /* 等到最早的模拟完成时间 */
+            emulate_wait_until(next);
+        }
+        else {
+            int ret = aio_reap(1);
+            if (ret < 0) {
+                return got > 0 ? got : ret;
+            }
+        }
+    }
+    return got;
+}
+/**
+ * @brief 等待所有在途请求完成并释放异步I/O资源
+ * 
+ * @param fd 
+ * @return int 
+ */
+int ddriver_aio_destroy(int fd) {
+    IGNORE_ARG(fd);
+    if (!aio.enabled) {
+        return 0;
+    }
+    while (aio.inflight + sched.queued > 0) {
+        if (aio_reap(1) < 0) {
+            user_panic("aio reap error, %d requests abandoned", aio.inflight + sched.queued);
+            break;
+        }
+    }
+    if (aio.use_uring)
+        aio_uring_destroy();
+    else if (!aio.use_map)
+        aio_pool_destroy();
+    aio.done = NULL;
+    aio.enabled = 0;
+    return 0;
+}
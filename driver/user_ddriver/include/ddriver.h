@@ -3,11 +3,43 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
+
+#define DDRIVER_AIO_READ        0
+#define DDRIVER_AIO_WRITE       1
+
+#define DDRIVER_MAP_READ        0   /* 映射后读取或部分修改，计一次读 */
+#define DDRIVER_MAP_WRITE       1   /* 映射后覆盖整段，不计读 */
+
+struct ddriver_aio_req
+{
+    int                     op;             /* DDRIVER_AIO_READ / DDRIVER_AIO_WRITE */
+    off_t                   offset;         /* aligned to io unit */
+    struct iovec           *iov;            /* each segment is a multiple of io unit */
+    int                     iovcnt;
+    int                     res;            /* bytes transferred or -errno */
+    void                   *priv;           /* caller cookie */
+    long long               deadline_ns;    /* internal */
+    struct ddriver_aio_req *next;           /* internal */
+};
 
 int ddriver_open(char *path);
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+void *ddriver_map_block(int fd, off_t offset, size_t size, int access);
+int ddriver_unmap_block(int fd, void *addr, size_t size, int dirty);
+int ddriver_aio_setup(int fd, int depth);
+int ddriver_aio_submit(int fd, struct ddriver_aio_req **reqs, int nr);
+int ddriver_aio_poll(int fd, struct ddriver_aio_req **done, int max);
+int ddriver_aio_wait(int fd, struct ddriver_aio_req **done, int min_nr, int max);
+int ddriver_aio_destroy(int fd);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
 
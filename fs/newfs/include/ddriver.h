@@ -3,6 +3,26 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
+
+#define DDRIVER_AIO_READ        0
+#define DDRIVER_AIO_WRITE       1
+
+#define DDRIVER_MAP_READ        0   /* 映射后读取或部分修改，计一次读 */
+#define DDRIVER_MAP_WRITE       1   /* 映射后覆盖整段，不计读 */
+
+/* 异步I/O请求 */
+struct ddriver_aio_req
+{
+    int                     op;             /* DDRIVER_AIO_READ / DDRIVER_AIO_WRITE */
+    off_t                   offset;         /* 须与设备IO单位对齐 */
+    struct iovec           *iov;            /* 每段大小须为设备IO单位的整数倍 */
+    int                     iovcnt;
+    int                     res;            /* 完成后填写：传输的字节数，负数为错误码 */
+    void                   *priv;           /* 调用者私有数据 */
+    long long               deadline_ns;    /* ddriver内部使用 */
+    struct ddriver_aio_req *next;           /* ddriver内部使用 */
+};
 
 /**
  * @brief 打开ddriver设备
@@ -18,9 +38,9 @@ int ddriver_open(char *path);
  * @param fd ddriver设备handler
  * @param offset 移动到的位置，注意要和设备IO单位对齐
  * @param whence SEEK_SET即可
- * @return int 0成功，否则失败
+ * @return off_t 移动后的位置，失败返回负数
  */
-int ddriver_seek(int fd, off_t offset, int whence);
+off_t ddriver_seek(int fd, off_t offset, int whence);
 
 /**
  * @brief 写入数据
@@ -42,6 +62,144 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 在指定位置读出数据，不移动共享的文件位置，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，须为设备IO单位的整数倍
+ * @param offset 读出的位置，注意要和设备IO单位对齐
+ * @return int 读出的字节数，负数失败
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 在指定位置写入数据，不移动共享的文件位置，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为设备IO单位的整数倍
+ * @param offset 写入的位置，注意要和设备IO单位对齐
+ * @return int 写入的字节数，负数失败
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 向量读出数据，一次调用读出多个连续扇区
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 读出的Buf数组，每段大小须为设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @return int 读出的字节数，负数失败
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 向量写入数据，一次调用写入多个连续扇区
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 写入的Buf数组，每段大小须为设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @return int 写入的字节数，负数失败
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 在指定位置向量读出数据
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 读出的Buf数组，每段大小须为设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @param offset 读出的位置，注意要和设备IO单位对齐
+ * @return int 读出的字节数，负数失败
+ */
+int ddriver_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 在指定位置向量写入数据
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 写入的Buf数组，每段大小须为设备IO单位的整数倍
+ * @param iovcnt Buf段数
+ * @param offset 写入的位置，注意要和设备IO单位对齐
+ * @return int 写入的字节数，负数失败
+ */
+int ddriver_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief 钉住一段设备内容，返回直接指向设备映像的指针，不经过拷贝
+ * 
+ * 只有mmap模式（DDRIVER_MMAP=1）可用，其他模式返回NULL，此时应改用ddriver_pread等接口
+ * 
+ * @param fd ddriver设备handler
+ * @param offset 起始位置，注意要和设备IO单位对齐
+ * @param size 大小，须为设备IO单位的整数倍
+ * @param access DDRIVER_MAP_READ，或调用者会覆盖整段时用DDRIVER_MAP_WRITE（不计读）
+ * @return void* 设备内容，在ddriver_unmap_block之前有效，不可用时返回NULL
+ */
+void *ddriver_map_block(int fd, off_t offset, size_t size, int access);
+
+/**
+ * @brief 解除ddriver_map_block的映射
+ * 
+ * @param fd ddriver设备handler
+ * @param addr ddriver_map_block返回的指针
+ * @param size 与映射时相同
+ * @param dirty 映射期间是否修改过内容
+ * @return int 0成功，否则失败
+ */
+int ddriver_unmap_block(int fd, void *addr, size_t size, int dirty);
+
+/**
+ * @brief 初始化异步I/O，优先使用io_uring，不可用时使用线程池
+ * 
+ * @param fd ddriver设备handler
+ * @param depth 最多同时在途的请求数
+ * @return int 0成功，否则失败
+ */
+int ddriver_aio_setup(int fd, int depth);
+
+/**
+ * @brief 提交一批异步请求
+ * 
+ * 同一批请求先全部进入调度队列，再按调度策略（IOC_SET_SCHED_POLICY）排序、合并相邻扇区后派发
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组，请求完成并被取回前不能释放
+ * @param nr 请求数
+ * @return int 进入调度队列的请求数（受调度队列长度限制），负数失败
+ */
+int ddriver_aio_submit(int fd, struct ddriver_aio_req **reqs, int nr);
+
+/**
+ * @brief 取回已完成的请求，不阻塞
+ * 
+ * @param fd ddriver设备handler
+ * @param done 输出已完成的请求
+ * @param max done数组大小
+ * @return int 取回的请求数
+ */
+int ddriver_aio_poll(int fd, struct ddriver_aio_req **done, int max);
+
+/**
+ * @brief 等待至少min_nr个请求完成
+ * 
+ * @param fd ddriver设备handler
+ * @param done 输出已完成的请求
+ * @param min_nr 至少等待的请求数
+ * @param max done数组大小
+ * @return int 取回的请求数
+ */
+int ddriver_aio_wait(int fd, struct ddriver_aio_req **done, int min_nr, int max);
+
+/**
+ * @brief 等待在途请求全部完成并释放异步I/O资源
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_aio_destroy(int fd);
+
 /**
  * @brief ddriver IO控制
  * 
@@ -13,9 +13,46 @@ struct ddriver_state
     int seek_cnt;
 };
 
+/* 异步请求调度策略，只作用于ddriver_aio_*路径 */
+#define DDRIVER_SCHED_NOOP      0           /* 按到达顺序派发，只合并相邻扇区 */
+#define DDRIVER_SCHED_CLOOK     1           /* 循环电梯：从磁头位置向高地址扫描，到头后跳回最低地址 */
+#define DDRIVER_SCHED_DEADLINE  2           /* 同CLOOK，但等待超时的请求优先派发 */
+
+struct ddriver_sched_state
+{
+    int       policy;                       /* 当前调度策略 */
+    int       queued;                       /* 尚未派发的请求数 */
+    long long dispatch_cnt;                 /* 派发到设备的请求数（合并后） */
+    long long merge_cnt;                    /* 被合并掉的请求数 */
+    long long seek_dist;                    /* 实际派发顺序下的磁头移动总距离（字节） */
+    long long seek_dist_fifo;               /* 按到达顺序派发时的磁头移动总距离（字节），与seek_dist之差即调度节省的距离 */
+};
+
+/* 延迟直方图按2的幂分桶：桶0为0ns，桶i（i>0）为[2^(i-1), 2^i)ns，最后一桶包含更长的延迟 */
+#define DDRIVER_HIST_BUCKETS    32
+
+struct ddriver_stat64
+{
+    long long read_cnt;                     /* 读请求数 */
+    long long write_cnt;                    /* 写请求数 */
+    long long seek_cnt;                     /* 磁头移动次数 */
+    long long read_bytes;                   /* 读出的字节数 */
+    long long write_bytes;                  /* 写入的字节数 */
+    long long read_lat_ns;                  /* 读请求的累计延迟（ns），含排队时间 */
+    long long write_lat_ns;                 /* 写请求的累计延迟（ns），含排队时间 */
+    long long seek_dist;                    /* 磁头移动总距离（字节），含同步与异步请求 */
+    long long read_hist[DDRIVER_HIST_BUCKETS];  /* 读延迟直方图 */
+    long long write_hist[DDRIVER_HIST_BUCKETS]; /* 写延迟直方图 */
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_SET_SCHED_POLICY    _IOW(IOC_MAGIC, 4, int)                     /* 设置异步请求调度策略，DDRIVER_SCHED_* */
+#define IOC_REQ_SCHED_STATE     _IOR(IOC_MAGIC, 5, struct ddriver_sched_state) /* 请求调度器状态，返回 ddriver_sched_state */
+#define IOC_REQ_DEVICE_SYNC     _IO(IOC_MAGIC, 6)                           /* 请求将设备写入落盘 */
+#define IOC_REQ_DEVICE_STAT64   _IOR(IOC_MAGIC, 7, struct ddriver_stat64)   /* 请求64位设备统计，返回 ddriver_stat64 */
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 8, long long)               /* 请求查看设备大小（64位），超过2GB的设备使用 */
 
 #endif
\ No newline at end of file
@@ -13,13 +13,33 @@
 #include "errno.h"
 #include "types.h"
 #include "stdint.h"
+#include <limits.h>
 
 #define NEWFS_MAGIC                  /* TODO: Define by yourself */
 #define NEWFS_DEFAULT_PERM    0777   /* 全权限打开 */
 
-#define NFS_MAGIC_NUM 0x52415453
-#define NFS_BLKS_SZ() (1024)
-#define NFS_IO_SZ() (512)
+#define NFS_MAGIC_NUM 0x52415458      /* 磁盘格式每变化一次加 1 */
+#define NFS_MAGIC_NUM_MIN 0x52415453  /* 最早的格式：[NFS_MAGIC_NUM_MIN, NFS_MAGIC_NUM) 的镜像不能再挂载 */
+#define NFS_BLKS_SZ() (super.sz_blks)  /* 逻辑块大小，取 NFS_BLKS_SZ_MIN 与设备 IO 大小中的较大者 */
+#define NFS_IO_SZ() (super.sz_io)      /* 设备 IO 大小（扇区大小），由驱动给出 */
+#define NFS_BLKS_SZ_MIN 1024
+#define NFS_SECS_PER_BLK() (NFS_BLKS_SZ() / NFS_IO_SZ())
+#define NFS_SECS_ALL() ((uint32_t)((1ULL << NFS_SECS_PER_BLK()) - 1))
+#define NFS_CACHE_DEFAULT_BLKS  256  /* 默认缓存 256 块 = 256KB */
+#define NFS_AIO_DEPTH           32   /* 异步 I/O 队列深度 */
+#define NFS_PREFETCH_BATCH      32   /* 一次提交预读的块数 */
+#define NFS_DCACHE_SLOTS        4096 /* 路径缓存槽数 */
+#define NFS_PCACHE_DEFAULT_PAGES 1024 /* 默认页缓存 1024 页 */
+#define NFS_RA_MIN_BLKS         4    /* 顺序读初始预读窗口 */
+#define NFS_RA_MAX_BLKS         128  /* 预读窗口上限 */
+#define NFS_DHASH_MIN           8    /* 目录项超过该数目时才建立哈希表 */
+#define NFS_IO_SCHED_DEFAULT    DDRIVER_SCHED_CLOOK /* 默认使用循环电梯调度 */
+#define NFS_FLUSH_INTERVAL      5    /* 默认每 5 秒刷写一次脏数据 */
+#define NFS_JOURNAL_BLKS        64   /* 日志区块数：描述块 + 块映像 + 提交块 */
+#define NFS_TRUNC_CHUNK         16   /* 截断时每段释放的块数，每段之后都可以提前刷写 */
+#define NFS_FREE_PENDING_INIT   64   /* 待释放块集合的初始容量，不够时加倍 */
+#define NFS_JOURNAL_MAGIC       0x4A524E4C
+#define NFS_COMMIT_MAGIC        0x434D4954
 
 /* 错误码 */
 #define NFS_ERROR_NONE          0
@@ -32,8 +52,8 @@
 
 /* 偏移计算 */
 #define NFS_SUPER_OFS           0
-#define NFS_INO_OFS(ino)        (super.inode_offset * NFS_BLKS_SZ() + \
-                                 (ino) * sizeof(struct newfs_inode_d))
+#define NFS_INO_OFS(ino)        ((off_t)super.groups[NFS_INO_GROUP(ino)].inode_offset * NFS_BLKS_SZ() + \
+                                 ((ino) % super.inos_per_group) * sizeof(struct newfs_inode_d))
 
 /* 对齐宏 */
 #define NFS_ROUND_DOWN(value, round) ((value) & (~((round) - 1)))
@@ -42,6 +62,40 @@
 /* 类型判断 */
 #define NFS_IS_DIR(inode)       ((inode)->ftype == NFS_DIR)
 #define NFS_IS_REG(inode)       ((inode)->ftype == NFS_REG_FILE)
+#define NFS_IS_SYM_LINK(inode)  ((inode)->ftype == NFS_SYM_LINK)
+
+/* 全局锁 */
+#define NFS_LOCK()              pthread_mutex_lock(&super.lock)
+#define NFS_UNLOCK()            pthread_mutex_unlock(&super.lock)
+
+#define NFS_PTRS_PER_BLK()      (NFS_BLKS_SZ() / sizeof(uint32_t))   /* 每个间接块中的块号数 */
+
+/* 变长目录项：12 字节头部加名字，按 4 字节对齐 */
+#define NFS_DENTRY_REC_LEN(name_len) NFS_ROUND_UP(sizeof(struct newfs_dentry_d) + (name_len), 4)
+#define NFS_DENTRY_REC_MAX      NFS_DENTRY_REC_LEN(MAX_NAME_LEN - 1)
+#define NFS_DENTRYS_PER_BLK()   (NFS_BLKS_SZ() / NFS_DENTRY_REC_MAX)  /* 最坏情况下每块的目录项数 */
+
+/* 目录项写在目录自己的数据块里，目录大小同样受 file_max 限制（按最长名字估算） */
+#define NFS_DIR_HAS_ROOM(inode) \
+    (((inode)->dir_cnt + NFS_DENTRYS_PER_BLK()) / NFS_DENTRYS_PER_BLK() * NFS_BLKS_SZ() <= super.file_max)
+
+/* 块组：每组的数据位图占一个块，最多管理 NFS_BLKS_SZ() * 8 个块 */
+#define NFS_BLKS_PER_GROUP()    (NFS_BLKS_SZ() * 8)
+#define NFS_INO_GROUP(ino)      ((ino) / super.inos_per_group)
+#define NFS_BLK_GROUP(blk)      ((blk) / super.blks_per_group)
+
+/* 记录位图中被修改的字节，刷写时只写回 [lo, hi) */
+#define NFS_MAP_DIRTY(lo, hi, byte)                 \
+    do {                                            \
+        if ((lo) >= (hi)) {                         \
+            (lo) = (byte);                          \
+            (hi) = (byte) + 1;                      \
+        }                                           \
+        else {                                      \
+            if ((byte) < (lo)) (lo) = (byte);       \
+            if ((byte) + 1 > (hi)) (hi) = (byte) + 1;  \
+        }                                           \
+    } while (0)
 
 /******************************************************************************
 * SECTION: newfs.c
@@ -63,14 +117,91 @@ int   			   newfs_rmdir(const char *);
 int   			   newfs_rename(const char *, const char *);
 int   			   newfs_utimens(const char *, const struct timespec tv[2]);
 int   			   newfs_truncate(const char *, off_t);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
+int   			   newfs_statfs(const char *, struct statvfs *);
+int   			   newfs_symlink(const char *, const char *);
+int   			   newfs_readlink(const char *, char *, size_t);
 
 /* 辅助函数 */
-int                newfs_driver_read(int offset, uint8_t *out_content, int size);
-int                newfs_driver_write(int offset, uint8_t *in_content, int size);
+int                newfs_driver_read(off_t offset, uint8_t *out_content, int size);
+int                newfs_driver_write(off_t offset, uint8_t *in_content, int size);
 int                newfs_alloc_data_block();
+int                newfs_alloc_data_blocks(int goal, int want, int *got);
+int                newfs_map_blocks(struct newfs_inode *inode, int lblk, int cnt);
+int                newfs_bmap(struct newfs_inode *inode, int lblk);
+int                newfs_bmap_meta_blks(struct newfs_inode *inode, int lo, int hi, int cnt);
 void               newfs_free_data_block(int block_no);
+int                newfs_read_block(int fd, int block_no, uint8_t *buf);
+int                newfs_write_block(int fd, int block_no, uint8_t *buf);
+int                newfs_sync_inode(struct newfs_inode *inode);
+int                newfs_unmap_blocks(struct newfs_inode *inode, int lblk);
+
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int                newfs_cache_init(int capacity);
+void               newfs_cache_destroy();
+uint8_t*           newfs_cache_get(int block_no, int bias, int len, bool dirty);
+int                newfs_cache_sync();
+int                newfs_cache_prefetch(const int *blks, int nr);
+int                newfs_dev_read(off_t offset, uint8_t *buf, int size);
+int                newfs_dev_write(off_t offset, uint8_t *buf, int size);
+int                newfs_cache_dirty_blks(int *blks, int max);
+uint8_t*           newfs_cache_peek(int block_no, uint32_t *valid);
+void               newfs_cache_forget(int block_no);
+uint8_t*           newfs_cache_pin(int block_no, bool dirty);
+void               newfs_cache_unpin(int block_no);
+int                newfs_cache_sync_blks(const int *blks, int nr);
+int                newfs_aio_run(struct ddriver_aio_req **reqs, int nr);
+
+/******************************************************************************
+* SECTION: newfs_pcache.c
+*******************************************************************************/
+int                newfs_pcache_init(int capacity);
+void               newfs_pcache_destroy();
+int                newfs_pcache_read(struct newfs_inode *inode, int offset, uint8_t *buf, int size);
+int                newfs_pcache_write(struct newfs_inode *inode, int offset, const uint8_t *buf, int size);
+int                newfs_pcache_truncate(struct newfs_inode *inode, int size);
+int                newfs_pcache_sync();
+int                newfs_pcache_free_blks();
+int                newfs_pcache_resv(struct newfs_inode *inode, int blks);
+int                newfs_pcache_meta_blks();
+bool               newfs_pcache_has_dirty(struct newfs_inode *inode);
+int                newfs_pcache_readahead(struct newfs_inode *inode, int lblk, int cnt);
+
+/******************************************************************************
+* SECTION: newfs_bitmap.c
+*******************************************************************************/
+int                newfs_bitmap_alloc(uint8_t *map, int nbits, int *hint);
+int                newfs_bitmap_alloc_run(uint8_t *map, int nbits, int *hint, int want, int *got);
+bool               newfs_bitmap_free(uint8_t *map, int bit);
+int                newfs_bitmap_count(const uint8_t *map, int nbits);
+
+/******************************************************************************
+* SECTION: newfs_dcache.c
+*******************************************************************************/
+int                newfs_dcache_init(int slots);
+void               newfs_dcache_destroy();
+struct newfs_dentry* newfs_dcache_lookup(const char *path, bool *is_find);
+void               newfs_dcache_insert(const char *path, struct newfs_dentry *dentry, bool is_find);
+void               newfs_dcache_invalidate(const char *path);
+void               newfs_dcache_flush();
+
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+void               newfs_mark_inode_dirty(struct newfs_inode *inode);
+void               newfs_clear_inode_dirty(struct newfs_inode *inode);
+void               newfs_flush_if_needed();
+int                newfs_flush();
+int                newfs_journal_format();
+int                newfs_journal_replay();
+int                newfs_flusher_start(int interval);
+void               newfs_flusher_stop();
 
 #endif  /* _newfs_H_ */
\ No newline at end of file
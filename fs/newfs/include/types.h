@@ -3,7 +3,12 @@
 
 #define MAX_NAME_LEN    128
 #define NFS_DATA_PER_FILE 6
+#define NFS_IND_LEVELS    3        /* 一级、二级、三级间接块 */
+#define NFS_JOURNAL_MAX_ENTS 126   /* 日志描述块最多记录的块数：(1024 - 16) / 8 */
+#define NFS_DCACHE_PATH_LEN 256    /* 路径缓存能容纳的最长路径（含结尾 0），更长的路径不缓存 */
+#define NFS_INLINE_MAX    MAX_NAME_LEN /* 内联在 inode 中的文件数据上限，与 target_path 共用空间 */
 #include <stdbool.h>
+#include <pthread.h>
 
 #define SFS_ASSIGN_FNAME(psfs_dentry, _fname) \
     memcpy(psfs_dentry->name, _fname, strlen(_fname))
@@ -21,14 +26,136 @@ struct newfs_dentry;
 
 struct custom_options {
 	const char*        device;
+	int                cache_blks;    /* 块缓存容量（块数），--cache_blks=N */
+	int                io_sched;      /* 驱动异步请求调度策略，--io_sched=N，见DDRIVER_SCHED_* */
+	int                flush_interval;/* 后台刷写周期（秒），--flush_interval=N，0 表示只在 umount 时刷写 */
+	int                page_blks;     /* 文件数据页缓存容量（页数），--page_blks=N */
+	int                stats;         /* --stats：umount 时打印缓存、日志和设备统计 */
+};
+
+/* 块缓存中的一个缓存块 */
+struct newfs_buf
+{
+    int block_no;                 /* 磁盘块号，-1 表示空闲 */
+    uint8_t *data;                /* 块内容 (NFS_BLKS_SZ) */
+    uint32_t valid;               /* 扇区有效位图：第 i 位表示第 i 个 512B 扇区已读入或已被完整写入 */
+    bool is_dirty;                /* 是否需要写回 */
+    bool ref;                     /* CLOCK 访问位 */
+    bool mapped;                  /* data 直接指向驱动映射的设备映像（只读，写入前先拷贝到 pool） */
+    int pin;                      /* newfs_cache_pin 的引用数，大于 0 时不会被置换 */
+    struct newfs_buf *hash_next;  /* 哈希链 */
+};
+
+/* 写回式块缓存：哈希索引 + CLOCK 置换 */
+struct newfs_cache
+{
+    int capacity;                 /* 缓存块数 */
+    int hash_sz;                  /* 哈希桶数 */
+    int clock_hand;               /* CLOCK 指针 */
+    struct newfs_buf *bufs;       /* 缓存块数组 */
+    struct newfs_buf **hash;      /* 哈希桶 */
+    uint8_t *pool;                /* 所有块数据的连续内存 */
+    int dirty_cnt;                /* 脏块数 */
+
+    /* 统计 */
+    int hit_cnt;
+    int miss_cnt;
+    int evict_cnt;
+    int flush_cnt;
+    int skip_read_cnt;            /* 因整扇区覆盖写而省去的扇区预读次数 */
+    int map_cnt;                  /* 直接映射设备映像、省去读拷贝的块数 */
+};
+
+/* 页缓存中的一页：文件的一个逻辑块 */
+struct newfs_page
+{
+    int lblk;                     /* 文件内的逻辑块号 */
+    int block_no;                 /* 映射到的物理块号，0 表示尚未分配（脏页为延迟分配） */
+    uint8_t *data;                /* 页内容 (NFS_BLKS_SZ) */
+    bool is_dirty;                /* 是否需要写回 */
+    int pin;                      /* 大于 0 时不会被置换 */
+    struct newfs_inode *inode;    /* 所属文件 */
+    struct newfs_page *hash_next; /* 文件页哈希表中的冲突链 */
+    struct newfs_page *lru_prev;  /* 全局 LRU 链表，表头一端最近访问 */
+    struct newfs_page *lru_next;
+};
+
+/* 所有文件共享的页缓存：容量上限与 LRU 置换是全局的，页按文件索引 */
+struct newfs_pcache
+{
+    int capacity;                 /* 最多缓存的页数 */
+    int page_cnt;                 /* 当前缓存的页数 */
+    int dirty_cnt;                /* 其中的脏页数 */
+    int delalloc_cnt;             /* 其中尚未分配物理块的页数 */
+    int resv_blks;                /* 所有文件预留的块数之和 */
+    struct newfs_page lru;        /* LRU 链表头（哨兵） */
+
+    /* 统计 */
+    int hit_cnt;
+    int miss_cnt;
+    int evict_cnt;
+    int writeback_cnt;            /* 写回的页数 */
+    int write_req_cnt;            /* 写回时合并成的设备写请求数 */
+    int ra_cnt;                   /* 预读的页数 */
+    int ra_req_cnt;               /* 预读合并成的设备读请求数 */
+    int alloc_cnt;                /* 写回时延迟分配的页数 */
+    int alloc_req_cnt;            /* 延迟分配调用分配器的次数（逻辑连续的段数） */
+};
+
+/* 路径缓存的一项：完整路径 -> newfs_lookup 的结果 */
+struct newfs_dcache_entry
+{
+    uint32_t hash;                /* 路径哈希，0 表示空槽 */
+    uint32_t pos_gen;             /* 插入时的 dcache.pos_gen */
+    uint32_t neg_gen;             /* 插入时的 dcache.neg_gen，只对负项有意义 */
+    bool is_find;                 /* false 为负项：路径不存在 */
+    struct newfs_dentry *dentry;  /* 找到的 dentry；负项为查找停下处的 dentry */
+    char path[NFS_DCACHE_PATH_LEN];
+};
+
+/* 全局路径缓存：直接映射，失效通过代数整体完成 */
+struct newfs_dcache
+{
+    int slots;                    /* 槽数，2 的幂 */
+    struct newfs_dcache_entry *entries;
+    uint32_t pos_gen;             /* 递增后所有项失效（摘除目录项） */
+    uint32_t neg_gen;             /* 递增后所有负项失效（mkdir/mknod） */
+
+    /* 统计 */
+    int hit_cnt;
+    int neg_hit_cnt;
+    int miss_cnt;
+};
+
+/* 块组（只在内存中），布局由超级块中的分组参数推算：
+ * 第 0 组接在超级块之后，其余组从组首依次是 inode 位图、数据位图、inode 表、数据 */
+struct newfs_group
+{
+    int ino_bitmap_offset;
+    int data_bitmap_offset;
+    int inode_offset;
+    int data_offset;
+    int data_blks;
+    uint8_t *map_inode;           /* 指向 super.map_inode 中本组的一块 */
+    uint8_t *map_data;            /* 指向 super.map_data 中本组的一块 */
+
+    /* next-fit 位置与空闲计数，挂载时统计 */
+    int ino_hint;
+    int data_hint;
+    int ino_free;
+    int data_free;
+
+    /* 位图脏字节区间 [lo, hi)，lo >= hi 表示干净 */
+    int ino_map_dirty_lo, ino_map_dirty_hi;
+    int data_map_dirty_lo, data_map_dirty_hi;
 };
 
 struct newfs_super
 {
     int fd;
 
-    int sz_io;  /* = 512B */
-    int sz_disk; /* = 4MB */
+    int sz_io;  /* = 512B，由驱动给出 */
+    long long sz_disk; /* = 4MB，由驱动给出 */
     int sz_usage;
     int sz_blks; /* = 1024B */
 
@@ -38,28 +165,71 @@ struct newfs_super
     int sb_offset;  /* offset = 0 */
     int sb_blks;  /* = 1 */
 
-    uint8_t *map_inode;
+    uint8_t *map_inode;     /* 各组 inode 位图依次存放，每组一块 */
     int ino_bitmap_offset;  /* offset = 1 */
     int ino_bitmap_blks;  /* = 1 */
 
-    uint8_t *map_data;
+    uint8_t *map_data;      /* 各组数据位图依次存放，每组一块 */
     int data_bitmap_offset; /* offset = 2 */
     int data_bitmap_blks;  /* = 1 */
 
     /* Struct inode */
-    int inode_blks;    /* Size of inode map (block) */
-    int inode_offset;  /* offset of inode */
+    int inode_blks;    /* Size of inode map (block)，每组相同 */
+    int inode_offset;  /* offset of inode，第 0 组 */
     
-    int data_offset;
-    int data_blks;
+    int data_offset;   /* 第 0 组 */
+    int data_blks;     /* 所有组合计 */
     
-    int max_ino;
+    int max_ino;       /* 所有组合计 */
     int file_max;
 
+    /* 块组 */
+    struct newfs_group *groups;
+    int group_cnt;
+    int blks_per_group;
+    int inos_per_group;
+    int data_group;    /* 上次分配数据块的组，next-fit 从这里继续 */
+
+    /* 所有组的空闲计数之和，statfs 直接返回 */
+    int ino_free;
+    int data_free;
+
     bool is_mounted;
 
     int root_ino;
     struct newfs_dentry *root_dentry;
+
+    struct newfs_cache cache;     /* 块缓存 */
+    struct newfs_dcache dcache;   /* 路径缓存 */
+    struct newfs_pcache pcache;   /* 文件数据页缓存 */
+    bool aio_enabled;             /* 驱动异步 I/O 是否可用 */
+
+    /* 日志区，位于磁盘末尾 */
+    int journal_offset;
+    int journal_blks;
+    uint32_t journal_seq;
+
+    /* 脏数据跟踪：只刷写变化过的 inode、位图字节和超级块 */
+    struct newfs_inode *dirty_inodes;
+    int dirty_inode_cnt;
+    bool sb_dirty;
+
+    /* 待释放的数据块：日志事务提交后才清除位图、可以再分配 */
+    int *free_pending;
+    int free_pending_cnt;
+    int free_pending_cap;
+
+    /* 全局锁：FUSE 多线程回调与后台刷写线程互斥 */
+    pthread_mutex_t lock;
+    pthread_cond_t flush_cond;
+    pthread_t flusher;
+    bool flusher_running;
+    bool flusher_stop;
+
+    /* 刷写统计 */
+    int flush_cnt;
+    int flush_inode_cnt;
+    int journal_tx_cnt;
 };
 
 struct newfs_inode
@@ -68,11 +238,29 @@ struct newfs_inode
     uint32_t size;       /* 统一使用 uint32_t */
     uint32_t dir_cnt;    /* 统一使用 uint32_t */
     NFS_FILE_TYPE ftype; /* 添加文件类型字段 */
-    char target_path[MAX_NAME_LEN];
+    uint8_t inline_data[NFS_INLINE_MAX]; /* 内联数据：小文件内容或符号链接目标，size 之后全为 0 */
+    bool is_inline;                 /* 数据在 inline_data 中，不占数据块 */
     struct newfs_dentry *dentry;  /* 指向该inode的dentry */
     struct newfs_dentry *dentrys; /* 所有目录项 */
-    uint32_t block_pointer[NFS_DATA_PER_FILE]; /* 磁盘块号数组（动态分配） */
-    uint8_t *data;
+    uint32_t block_pointer[NFS_DATA_PER_FILE]; /* 逻辑块 -> 物理块，0 为未分配；由磁盘上的 extents 展开 */
+    uint32_t indirect[NFS_IND_LEVELS];         /* 直接块之后的逻辑块经一、二、三级间接块映射 */
+    uint32_t bmap_leaf;             /* 上次映射用到的最末级间接块，0 表示无 */
+    int bmap_leaf_base;             /* bmap_leaf 中第 0 项对应的逻辑块 */
+    struct newfs_page **pages;      /* 页哈希表（逻辑块号 -> 页），没有缓存页时为 NULL */
+    uint32_t pages_sz;              /* 哈希桶数，2 的幂 */
+    uint32_t page_cnt;              /* 本文件缓存的页数 */
+    int delalloc_cnt;               /* 本文件延迟分配的脏页数 */
+    int delalloc_lo, delalloc_hi;   /* 延迟分配页的逻辑块范围，delalloc_cnt 为 0 时无意义 */
+    int resv_blks;                  /* 为本文件预留的块数：延迟分配的页及其所需的间接块 */
+    bool is_dirty;                  /* inode 或其目录项需要刷写 */
+    struct newfs_inode *dirty_next; /* 脏 inode 链表 */
+    struct newfs_dentry **dhash;    /* 目录项哈希表（名字 -> dentry），目录项较少时为 NULL */
+    uint32_t dhash_sz;              /* 哈希桶数，2 的幂 */
+    uint32_t dir_gen;               /* 目录项被移除的次数，readdir 游标据此判断是否失效 */
+    struct newfs_dentry *dir_tail;  /* 最后一个目录块中的第一个目录项，NULL 表示下次整体重新打包 */
+    int dir_tail_blk;               /* dir_tail 所在的逻辑块 */
+    struct newfs_dentry *dir_synced;/* 上次打包时的链表头，之前的目录项尚未写入 */
+    uint32_t dir_synced_cnt;        /* 上次打包时的目录项数 */
 };
 
 struct newfs_dentry {
@@ -83,6 +271,22 @@ struct newfs_dentry {
     struct newfs_dentry *brother; /* 兄弟 */
     struct newfs_inode *inode;    /* 指向inode */
     NFS_FILE_TYPE ftype;
+    struct newfs_dentry *hash_next; /* 父目录哈希表中的冲突链 */
+};
+
+/* open 时分配、保存在 fi->fh 中的打开文件状态：顺序读检测与预读窗口 */
+struct newfs_file {
+    int ra_next;                  /* 顺序读时下一次读取应从这个逻辑块开始 */
+    int ra_window;                /* 当前预读窗口（块数） */
+    int ra_end;                   /* 已经预读到的位置（不含） */
+};
+
+/* opendir 时分配、保存在 fi->fh 中的 readdir 游标 */
+struct newfs_dir_cursor {
+    struct newfs_inode *inode;    /* 打开的目录 */
+    struct newfs_dentry *next;    /* 下一个要返回的目录项 */
+    int64_t offset;               /* next 在目录项链表中的序号 */
+    uint32_t dir_gen;             /* 定位时目录的 dir_gen */
 };
 
 /* static inline struct newfs_dentry *new_dentry(char *fname, NFS_FILE_TYPE ftype)
@@ -130,24 +334,74 @@ struct newfs_super_d
     int file_max;       /* 支持文件的最大大小 */
 
     int root_ino;
+
+    /* 日志区 */
+    int journal_offset;
+    int journal_blks;
+
+    /* 块组参数 */
+    int group_cnt;
+    int blks_per_group;
+    int inos_per_group;
+};
+
+/* 日志中一个块的记录：块号及其有效扇区位图，重放时只写有效扇区 */
+struct newfs_journal_blk_d
+{
+    uint32_t block_no;
+    uint32_t valid;
+};
+
+/* 日志描述块，位于日志区第一个块，其后依次是 nr 个块映像和一个提交块 */
+struct newfs_journal_d
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t nr;
+    uint32_t reserved;
+    struct newfs_journal_blk_d blks[NFS_JOURNAL_MAX_ENTS];
+};
+
+/* 日志提交块，seq 与描述块一致且校验和匹配时事务才算提交 */
+struct newfs_commit_d
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t checksum;
+};
+
+/* 一段物理连续的数据块：逻辑块 [lblk, lblk + len) -> 物理块 [start, start + len) */
+struct newfs_extent_d
+{
+    uint32_t lblk;
+    uint32_t start;
+    uint32_t len;                        /* 0 表示空项 */
 };
 
 struct newfs_inode_d
 {
     uint32_t ino;                        /* 在inode位图中的下标 */
     uint32_t size;                       /* 文件已占用空间 */
-    char target_path[MAX_NAME_LEN];      /* store traget path when it is a symlink */
+    union {
+        char target_path[MAX_NAME_LEN];  /* store traget path when it is a symlink */
+        uint8_t inline_data[NFS_INLINE_MAX]; /* 普通文件或符号链接不超过 NFS_INLINE_MAX 字节且没有数据块时，内容放在这里 */
+    };
 
-    uint32_t block_pointer[NFS_DATA_PER_FILE];
+    struct newfs_extent_d extents[NFS_DATA_PER_FILE]; /* 每块一项也放得下，最碎时仍能描述 */
+    uint32_t indirect[NFS_IND_LEVELS];   /* 间接块的物理块号，0 为未分配 */
     uint32_t dir_cnt;
     NFS_FILE_TYPE ftype;
 };
 
+/* 变长目录项（ext2 风格），记录不跨块 */
 struct newfs_dentry_d
 {
-    char fname[MAX_NAME_LEN];
-    NFS_FILE_TYPE ftype;
-    uint32_t ino; /* 指向的ino号 */
+    uint32_t ino;       /* 指向的ino号 */
+    uint32_t rec_len;   /* 本记录长度：头部加名字，按 4 字节对齐；块内最后一条记录延伸到块尾，64KB 块时可达 65536 */
+    uint8_t  name_len;  /* 名字长度（不含结尾 0），0 表示空记录 */
+    uint8_t  ftype;     /* NFS_FILE_TYPE */
+    uint8_t  pad[2];
+    char     fname[];   /* 名字，不以 0 结尾 */
 };
 
 #endif /* _TYPES_H_ */
\ No newline at end of file
@@ -12,6 +12,11 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--io_sched=%d", io_sched),
+	OPTION("--flush_interval=%d", flush_interval),
+	OPTION("--page_blks=%d", page_blks),
+	OPTION("--stats", stats),
 	FUSE_OPT_END
 };
 
@@ -21,18 +26,23 @@ struct newfs_super super;
 /* 函数声明 */
 struct newfs_dentry *newfs_alloc_dentry(const char *name, NFS_FILE_TYPE ftype);
 struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry);
-int newfs_alloc_ino();
+static void newfs_free_inode(struct newfs_inode *inode);
+int newfs_alloc_ino(int group);
 int newfs_sync_inode(struct newfs_inode *inode);
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino);
 int newfs_alloc_dentry_to_inode(struct newfs_inode *inode, struct newfs_dentry *dentry);
+static int newfs_dir_reserve(struct newfs_inode *inode, int extra);
 struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir_index);
+struct newfs_dentry *newfs_find_dentry(struct newfs_inode *inode, const char *name);
+static int newfs_dhash_resize(struct newfs_inode *inode, int cnt);
+static int newfs_calc_file_max(int data_blks);
+static int newfs_file_write(struct newfs_inode *inode, int offset, const uint8_t *buf, int size);
+static int newfs_file_read(struct newfs_inode *inode, int offset, uint8_t *buf, int size);
+static void newfs_group_layout(const struct newfs_super_d *super_d, int g, struct newfs_group *group);
+static int newfs_group_init(const struct newfs_super_d *super_d);
 char *newfs_get_fname(const char *path);
 struct newfs_dentry *newfs_lookup(const char *path, bool *is_find, bool *is_root);
 
-/* 辅助函数 */
-int newfs_read_block(int fd, int block_no, uint8_t *buf);
-int newfs_write_block(int fd, int block_no, uint8_t *buf);
-
 /******************************************************************************
 * SECTION: FUSE操作定义
 *******************************************************************************/
@@ -43,17 +53,23 @@ static struct fuse_operations operations = {
 	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
 	.readdir = newfs_readdir,				 /* 填充dentrys */
 	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
+	.write = newfs_write,					 /* 写入文件 */
+	.read = newfs_read,						 /* 读文件 */
 	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
+	.truncate = newfs_truncate,				 /* 改变文件大小 */
+	.fsync = newfs_fsync,					 /* 写回文件数据与元数据 */
 	.unlink = NULL,							  		 /* 删除文件 */
 	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
 	.rename = NULL,							  		 /* 重命名，mv */
 
-	.open = NULL,							
-	.opendir = NULL,
-	.access = NULL
+	.open = newfs_open,						 /* 打开文件，分配预读状态 */
+	.release = newfs_release,				 /* 关闭文件，释放预读状态 */
+	.opendir = newfs_opendir,				 /* 打开目录，分配 readdir 游标 */
+	.releasedir = newfs_releasedir,			 /* 关闭目录，释放游标 */
+	.access = NULL,
+	.statfs = newfs_statfs,					 /* 文件系统容量，df */
+	.symlink = newfs_symlink,				 /* 创建符号链接，ln -s */
+	.readlink = newfs_readlink				 /* 读取符号链接目标 */
 };
 /******************************************************************************
 * SECTION: 必做函数实现
@@ -71,19 +87,69 @@ void *newfs_init(struct fuse_conn_info *conn_info)
     uint8_t *temp_buf;
     bool is_init = false;
 
+    pthread_mutex_init(&super.lock, NULL);
+    pthread_cond_init(&super.flush_cond, NULL);
+    super.dirty_inodes = NULL;
+    super.dirty_inode_cnt = 0;
+    super.sb_dirty = false;
+    super.free_pending = NULL;
+    super.free_pending_cnt = super.free_pending_cap = 0;
+    super.flush_cnt = super.flush_inode_cnt = super.journal_tx_cnt = 0;
+
     /* 打开驱动 */
     super.fd = ddriver_open(newfs_options.device);
     if (super.fd < 0) {
         return NULL;
     }
 
-    /* 获取磁盘信息 */
-    ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE, &super.sz_disk);
+    /* 获取磁盘信息；不支持 64 位大小请求的驱动退回 int 协议 */
+    super.sz_disk = 0;
+    if (ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE64, &super.sz_disk) < 0 || super.sz_disk <= 0) {
+        int sz_disk = 0;
+        ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE, &sz_disk);
+        super.sz_disk = sz_disk;
+    }
     ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ, &super.sz_io);
 
-    super.sz_blks = 1024;
+    /* 一个块至少包含一个扇区；块内扇区有效位图为 32 位，扇区不能小于块的 1/32 */
+    super.sz_blks = super.sz_io > NFS_BLKS_SZ_MIN ? super.sz_io : NFS_BLKS_SZ_MIN;
+    if (super.sz_io <= 0 || NFS_SECS_PER_BLK() > 32) {
+        printf("[NEWFS] Error: unsupported device io size %d\n", super.sz_io);
+        ddriver_close(super.fd);
+        return NULL;
+    }
+    /* 块号是 32 位有符号整数 */
+    if (super.sz_disk / super.sz_blks > INT_MAX) {
+        printf("[NEWFS] Error: device too large (%lld bytes)\n", super.sz_disk);
+        ddriver_close(super.fd);
+        return NULL;
+    }
     super.blks_num = super.sz_disk / super.sz_blks;
 
+    /* 初始化块缓存 */
+    if (newfs_cache_init(newfs_options.cache_blks) != NFS_ERROR_NONE) {
+        ddriver_close(super.fd);
+        return NULL;
+    }
+
+    /* 初始化文件数据页缓存 */
+    if (newfs_pcache_init(newfs_options.page_blks) != NFS_ERROR_NONE) {
+        newfs_cache_destroy();
+        ddriver_close(super.fd);
+        return NULL;
+    }
+
+    /* 初始化路径缓存，失败时每次都走完整查找 */
+    if (newfs_dcache_init(NFS_DCACHE_SLOTS) != NFS_ERROR_NONE) {
+        printf("[NEWFS] Warning: dcache disabled\n");
+    }
+
+    /* 打开异步 I/O，失败时退化为同步读写 */
+    super.aio_enabled = (ddriver_aio_setup(super.fd, NFS_AIO_DEPTH) == 0);
+    if (ddriver_ioctl(super.fd, IOC_SET_SCHED_POLICY, &newfs_options.io_sched) < 0) {
+        printf("[NEWFS] Warning: unknown io_sched %d, keep driver default\n", newfs_options.io_sched);
+    }
+
     /* 读取超级块 */
     temp_buf = (uint8_t *)malloc(NFS_BLKS_SZ());
     ret = newfs_read_block(super.fd, 0, temp_buf);
@@ -94,6 +160,37 @@ void *newfs_init(struct fuse_conn_info *conn_info)
     memcpy(&super_d, temp_buf, sizeof(struct newfs_super_d));
     free(temp_buf);
 
+    /* 旧格式镜像的布局与当前格式不同，按当前格式读取会得到错乱的元数据，拒绝挂载而不是覆盖 */
+    if (super_d.magic_number >= NFS_MAGIC_NUM_MIN && super_d.magic_number < NFS_MAGIC_NUM) {
+        printf("[NEWFS] Error: image uses an older newfs format, reset the device (ddriver -r) to reformat\n");
+        ddriver_close(super.fd);
+        return NULL;
+    }
+
+    /* 块大小由扇区大小决定，换了扇区大小的设备不能再按原布局挂载 */
+    if (super_d.magic_number == NFS_MAGIC_NUM && super_d.sz_blks != super.sz_blks) {
+        printf("[NEWFS] Error: image block size %d, device gives %d\n", super_d.sz_blks, super.sz_blks);
+        ddriver_close(super.fd);
+        return NULL;
+    }
+
+    /* 重放上次未完成的日志事务，超级块本身也可能在事务中，重放后重新读取 */
+    if (super_d.magic_number == NFS_MAGIC_NUM) {
+        super.journal_offset = super_d.journal_offset;
+        super.journal_blks = super_d.journal_blks;
+        ret = newfs_journal_replay();
+        if (ret < 0) {
+            return NULL;
+        }
+        if (ret > 0) {
+            printf("[NEWFS] journal: replayed %d blocks\n", ret);
+            temp_buf = (uint8_t *)malloc(NFS_BLKS_SZ());
+            newfs_read_block(super.fd, 0, temp_buf);
+            memcpy(&super_d, temp_buf, sizeof(struct newfs_super_d));
+            free(temp_buf);
+        }
+    }
+
     /* 判断是否首次挂载 */
     if (super_d.magic_number != NFS_MAGIC_NUM) {
         /******************************************************************************
@@ -101,14 +198,20 @@ void *newfs_init(struct fuse_conn_info *conn_info)
          ******************************************************************************/
         
         /* 布局计算：
-         * sizeof(struct newfs_inode_d) = 4 + 4 + 128 + (4*6) + 4 + 4 = 168 字节
-         *   - ino(4) + size(4) + target_path(128) + block_pointer[6](24) + dir_cnt(4) + ftype(4)
-         * 平均每个文件 = 4 个数据块 + 1 个 inode = 4*1024 + 168 = 4264 字节
-         * 最大 inode 数 = 4096*1024 / 4264 = 983.48 ≈ 983
-         * inode 区域块数 = ceil(983 * 168 / 1024) = ceil(161.48) = 162 块
+         * sizeof(struct newfs_inode_d) = 4 + 4 + 128 + (12*6) + (4*3) + 4 + 4 = 228 字节
+         *   - ino(4) + size(4) + target_path(128) + extents[6](72) + indirect[3](12) + dir_cnt(4) + ftype(4)
+         * 平均每个文件 = 4 个数据块 + 1 个 inode = 4*1024 + 228 = 4324 字节
+         * 最大 inode 数 = 4096*1024 / 4324 = 970.00 ≈ 970
+         * inode 区域块数 = 970 * 228 / 1024 + 1 = 216 块
+         * 日志区占磁盘末尾 NFS_JOURNAL_BLKS 块，从数据区中扣除
+         *
+         * 磁盘超过 NFS_BLKS_PER_GROUP() 块时划分为多个块组，每组有自己的位图和
+         * inode 表，每组的 inode 数按整组大小同样计算；4MB 磁盘只有一组，布局同上
          */
-        int avg_file_size = 4 * NFS_BLKS_SZ() + sizeof(struct newfs_inode_d);  // 4264
-        int max_ino = (super.blks_num * NFS_BLKS_SZ()) / avg_file_size;        // 983
+        int avg_file_size = 4 * NFS_BLKS_SZ() + sizeof(struct newfs_inode_d);  // 4324
+        int grp_blks = super.blks_num < NFS_BLKS_PER_GROUP() ? super.blks_num : NFS_BLKS_PER_GROUP();
+        int inos_per_group = ((long long)grp_blks * NFS_BLKS_SZ()) / avg_file_size;  // 970
+        struct newfs_group group;
 
         /* 直接在 super_d 上计算布局 */
         super_d.magic_number = NFS_MAGIC_NUM;
@@ -126,13 +229,31 @@ void *newfs_init(struct fuse_conn_info *conn_info)
         super_d.data_bitmap_blks = 1;
         
         super_d.inode_offset = 3;
-        super_d.inode_blks = (max_ino * sizeof(struct newfs_inode_d)) / NFS_BLKS_SZ() + 1;
+        super_d.inode_blks = (inos_per_group * sizeof(struct newfs_inode_d)) / NFS_BLKS_SZ() + 1;
         
         super_d.data_offset = super_d.inode_offset + super_d.inode_blks;
-        super_d.data_blks = super.blks_num - super_d.data_offset;
+
+        super_d.journal_offset = super.blks_num - NFS_JOURNAL_BLKS;
+        super_d.journal_blks = NFS_JOURNAL_BLKS;
+
+        /* 最后一组放不下自己的位图和 inode 表时舍弃 */
+        super_d.blks_per_group = NFS_BLKS_PER_GROUP();
+        super_d.inos_per_group = inos_per_group;
+        super_d.group_cnt = (super.blks_num + NFS_BLKS_PER_GROUP() - 1) / NFS_BLKS_PER_GROUP();
+        newfs_group_layout(&super_d, super_d.group_cnt - 1, &group);
+        while (super_d.group_cnt > 1 && group.data_blks <= 0) {
+            super_d.group_cnt--;
+            newfs_group_layout(&super_d, super_d.group_cnt - 1, &group);
+        }
+
+        super_d.data_blks = 0;
+        for (int g = 0; g < super_d.group_cnt; g++) {
+            newfs_group_layout(&super_d, g, &group);
+            super_d.data_blks += group.data_blks;
+        }
         
-        super_d.max_ino = max_ino;
-        super_d.file_max = NFS_DATA_PER_FILE * NFS_BLKS_SZ();
+        super_d.max_ino = super_d.group_cnt * inos_per_group;
+        super_d.file_max = newfs_calc_file_max(super_d.data_blks);
         super_d.root_ino = 0;
         
         is_init = true;
@@ -162,56 +283,178 @@ void *newfs_init(struct fuse_conn_info *conn_info)
     super.file_max = super_d.file_max;
     super.root_ino = super_d.root_ino;
 
-    /* 分配位图内存 */
-    super.map_inode = (uint8_t *)malloc(NFS_BLKS_SZ());
-    super.map_data = (uint8_t *)malloc(NFS_BLKS_SZ());
+    super.journal_offset = super_d.journal_offset;
+    super.journal_blks = super_d.journal_blks;
+
+    super.group_cnt = super_d.group_cnt;
+    super.blks_per_group = super_d.blks_per_group;
+    super.inos_per_group = super_d.inos_per_group;
+
+    /* 计算各组布局，分配位图内存 */
+    if (newfs_group_init(&super_d) != NFS_ERROR_NONE) {
+        return NULL;
+    }
 
     if (is_init) {
         /******************************************************************************
          * SECTION: 首次挂载 - 初始化位图和根目录
          ******************************************************************************/
         
-        /* 清空位图 */
-        memset(super.map_inode, 0, NFS_BLKS_SZ());
-        memset(super.map_data, 0, NFS_BLKS_SZ());
+        /* 清空位图，所有组的位图绕过日志直接整块写入：组数多时装不进一个事务，
+         * 超级块最后随日志事务写入，在此之前崩溃只是格式化没有完成 */
+        memset(super.map_inode, 0, (size_t)super.group_cnt * NFS_BLKS_SZ());
+        memset(super.map_data, 0, (size_t)super.group_cnt * NFS_BLKS_SZ());
+        for (int g = 0; g < super.group_cnt; g++) {
+            struct newfs_group *group = &super.groups[g];
+
+            group->ino_free = super.inos_per_group;
+            group->data_free = group->data_blks;
+            group->ino_map_dirty_lo = group->data_map_dirty_lo = 0;
+            group->ino_map_dirty_hi = group->data_map_dirty_hi = 0;
+            if (newfs_dev_write((off_t)group->ino_bitmap_offset * NFS_BLKS_SZ(), group->map_inode, NFS_BLKS_SZ()) < 0
+                || newfs_dev_write((off_t)group->data_bitmap_offset * NFS_BLKS_SZ(), group->map_data, NFS_BLKS_SZ()) < 0) {
+                return NULL;
+            }
+        }
+        super.ino_free = super.max_ino;
+        super.data_free = super.data_blks;
         
-        /* 创建根目录 */
+        /* 创建根目录（根 inode 登记为脏，位图中第 0 位被置上） */
         super.root_dentry = newfs_alloc_dentry("/", NFS_DIR);
         super.root_dentry->inode = newfs_alloc_inode(super.root_dentry);
         
-        /* 标记根 inode 已使用 */
-        super.map_inode[0] |= 0x01;
-        
-        /* 将超级块写回磁盘 */
+        /* 超级块整块清零后写入 */
         temp_buf = (uint8_t *)calloc(1, NFS_BLKS_SZ());
-        memcpy(temp_buf, &super_d, sizeof(struct newfs_super_d));
         ret = newfs_write_block(super.fd, 0, temp_buf);
         free(temp_buf);
+        super.sb_dirty = true;
         
-        /* 写入位图 */
-        ret = newfs_write_block(super.fd, super.ino_bitmap_offset, super.map_inode);
-        ret = newfs_write_block(super.fd, super.data_bitmap_offset, super.map_data);
-        
-        /* 写入根 inode */
-        newfs_sync_inode(super.root_dentry->inode);
+        /* 格式化本身也作为一个日志事务提交 */
+        newfs_journal_format();
+        if (newfs_flush() != NFS_ERROR_NONE) {
+            return NULL;
+        }
     }
     else {
         /******************************************************************************
          * SECTION: 非首次挂载 - 读取位图和根目录
          ******************************************************************************/
         
-        /* 读取位图 */
-        ret = newfs_read_block(super.fd, super.ino_bitmap_offset, super.map_inode);
-        ret = newfs_read_block(super.fd, super.data_bitmap_offset, super.map_data);
+        /* 各组位图与根 inode 所在块分批提交，重叠读取 */
+        int mount_blks[NFS_PREFETCH_BATCH], nr = 0;
+
+        mount_blks[nr++] = NFS_INO_OFS(super.root_ino) / NFS_BLKS_SZ();
+        for (int g = 0; g < super.group_cnt; g++) {
+            mount_blks[nr++] = super.groups[g].ino_bitmap_offset;
+            mount_blks[nr++] = super.groups[g].data_bitmap_offset;
+            if (nr + 2 > NFS_PREFETCH_BATCH || g == super.group_cnt - 1) {
+                newfs_cache_prefetch(mount_blks, nr);
+                nr = 0;
+            }
+        }
+
+        /* 读取位图，统计各组空闲数 */
+        super.ino_free = super.data_free = 0;
+        for (int g = 0; g < super.group_cnt; g++) {
+            struct newfs_group *group = &super.groups[g];
+
+            ret = newfs_read_block(super.fd, group->ino_bitmap_offset, group->map_inode);
+            ret = newfs_read_block(super.fd, group->data_bitmap_offset, group->map_data);
+            group->ino_free = super.inos_per_group - newfs_bitmap_count(group->map_inode, super.inos_per_group);
+            group->data_free = group->data_blks - newfs_bitmap_count(group->map_data, group->data_blks);
+            super.ino_free += group->ino_free;
+            super.data_free += group->data_free;
+        }
         
         /* 读取根目录 */
         super.root_dentry = newfs_alloc_dentry("/", NFS_DIR);
         super.root_dentry->inode = newfs_read_inode(super.root_dentry, super.root_ino);
+        if (super.root_dentry->inode == NULL) {
+            printf("[NEWFS] Error: can't read root directory\n");
+            return NULL;
+        }
+    }
+
+    /* 周期性刷写脏数据 */
+    if (newfs_flusher_start(newfs_options.flush_interval) != NFS_ERROR_NONE) {
+        printf("[NEWFS] Warning: flusher not started, changes reach disk only at umount\n");
     }
 
     super.is_mounted = true;
     return NULL;
 }
+/**
+ * @brief 打印设备延迟直方图中非空的桶，每桶显示其上界
+ *
+ * @param name 操作类型
+ * @param hist 按 2 的幂分桶的延迟直方图
+ */
+static void newfs_print_hist(const char *name, const long long *hist)
+{
+    printf("[NEWFS] %s latency:", name);
+    for (int i = 0; i < DDRIVER_HIST_BUCKETS; i++)
+    {
+        if (hist[i] == 0)
+        {
+            continue;
+        }
+        if (i == DDRIVER_HIST_BUCKETS - 1)
+        {
+            printf(" >=%lldns:%lld", 1LL << (i - 1), hist[i]);
+        }
+        else
+        {
+            printf(" <%lldns:%lld", i ? 1LL << i : 1LL, hist[i]);
+        }
+    }
+    printf("\n");
+}
+/**
+ * @brief 打印本次挂载期间各层缓存、日志和设备的统计，--stats 时在 umount 时调用
+ */
+static void newfs_print_stats()
+{
+    struct ddriver_stat64 stat;
+    struct ddriver_sched_state sched_state;
+
+    printf("[NEWFS] flush: %d times, %d inodes, %d journal transactions\n",
+           super.flush_cnt, super.flush_inode_cnt, super.journal_tx_cnt);
+    printf("[NEWFS] cache: hit %d, miss %d, evict %d, flush %d\n",
+           super.cache.hit_cnt, super.cache.miss_cnt,
+           super.cache.evict_cnt, super.cache.flush_cnt);
+    printf("[NEWFS] pcache: hit %d, miss %d, evict %d, writeback %d pages in %d requests, "
+           "readahead %d pages in %d requests, delayed allocation %d pages in %d extents\n",
+           super.pcache.hit_cnt, super.pcache.miss_cnt, super.pcache.evict_cnt,
+           super.pcache.writeback_cnt, super.pcache.write_req_cnt,
+           super.pcache.ra_cnt, super.pcache.ra_req_cnt,
+           super.pcache.alloc_cnt, super.pcache.alloc_req_cnt);
+    printf("[NEWFS] dcache: hit %d, negative hit %d, miss %d\n",
+           super.dcache.hit_cnt, super.dcache.neg_hit_cnt, super.dcache.miss_cnt);
+
+    /* 设备 I/O 统计，整扇区写省去的预读数，以及直接映射省去读拷贝的块数 */
+    ddriver_ioctl(super.fd, IOC_REQ_DEVICE_STAT64, &stat);
+    printf("[NEWFS] device: read %lld, write %lld, seek %lld, pre-read saved %d, mapped %d\n",
+           stat.read_cnt, stat.write_cnt, stat.seek_cnt,
+           super.cache.skip_read_cnt, super.cache.map_cnt);
+    printf("[NEWFS] device: read %lld KB avg %lld ns, write %lld KB avg %lld ns, seek distance %lld\n",
+           stat.read_bytes / 1024, stat.read_cnt ? stat.read_lat_ns / stat.read_cnt : 0,
+           stat.write_bytes / 1024, stat.write_cnt ? stat.write_lat_ns / stat.write_cnt : 0,
+           stat.seek_dist);
+    if (stat.read_cnt)
+    {
+        newfs_print_hist("read", stat.read_hist);
+    }
+    if (stat.write_cnt)
+    {
+        newfs_print_hist("write", stat.write_hist);
+    }
+
+    /* 调度器统计：合并掉的请求数与相对到达顺序节省的磁头移动距离 */
+    ddriver_ioctl(super.fd, IOC_REQ_SCHED_STATE, &sched_state);
+    printf("[NEWFS] sched: policy %d, dispatch %lld, merged %lld, seek %lld, seek saved %lld\n",
+           sched_state.policy, sched_state.dispatch_cnt, sched_state.merge_cnt,
+           sched_state.seek_dist, sched_state.seek_dist_fifo - sched_state.seek_dist);
+}
 /**
  * @brief 卸载（umount）文件系统
  *
@@ -225,79 +468,44 @@ void newfs_destroy(void *p)
         return;
     }
 
-    struct newfs_super_d super_d;
-
-    /******************************************************************************
-     * SECTION: 1. 从根节点向下递归刷写所有 inode（包括目录项和文件数据）
-     ******************************************************************************/
-    newfs_sync_inode(super.root_dentry->inode);
-
     /******************************************************************************
-     * SECTION: 2. 将内存超级块写回磁盘
+     * SECTION: 1. 停止后台刷写线程
      ******************************************************************************/
-    super_d.magic_number = NFS_MAGIC_NUM;
-    super_d.sz_usage = super.sz_usage;
-    super_d.sz_blks = super.sz_blks;
-    super_d.blks_num = super.blks_num;
-
-    super_d.sb_offset = super.sb_offset;
-    super_d.sb_blks = super.sb_blks;
-
-    super_d.ino_bitmap_offset = super.ino_bitmap_offset;
-    super_d.ino_bitmap_blks = super.ino_bitmap_blks;
-
-    super_d.data_bitmap_offset = super.data_bitmap_offset;
-    super_d.data_bitmap_blks = super.data_bitmap_blks;
-
-    super_d.inode_offset = super.inode_offset;
-    super_d.inode_blks = super.inode_blks;
-
-    super_d.data_offset = super.data_offset;
-    super_d.data_blks = super.data_blks;
-
-    super_d.max_ino = super.max_ino;
-    super_d.file_max = super.file_max;
-    super_d.root_ino = super.root_ino;
-
-    /* 写入超级块到磁盘 */
-    if (newfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&super_d,
-                           sizeof(struct newfs_super_d)) != NFS_ERROR_NONE)
-    {
-        printf("[NEWFS] Error: Failed to write super block\n");
-    }
+    newfs_flusher_stop();
 
     /******************************************************************************
-     * SECTION: 3. 写回 inode 位图
+     * SECTION: 2. 只刷写上次刷写以来变化的 inode、目录项、位图字节，经日志落盘
      ******************************************************************************/
-    if (newfs_driver_write(super.ino_bitmap_offset * NFS_BLKS_SZ(),
-                           (uint8_t *)(super.map_inode),
-                           NFS_BLKS_SZ()) != NFS_ERROR_NONE)
+    if (newfs_flush() != NFS_ERROR_NONE)
     {
-        printf("[NEWFS] Error: Failed to write inode bitmap\n");
+        printf("[NEWFS] Error: Failed to flush dirty metadata\n");
     }
-
-    /******************************************************************************
-     * SECTION: 4. 写回数据块位图
-     ******************************************************************************/
-    if (newfs_driver_write(super.data_bitmap_offset * NFS_BLKS_SZ(),
-                           (uint8_t *)(super.map_data),
-                           NFS_BLKS_SZ()) != NFS_ERROR_NONE)
+    if (newfs_options.stats)
     {
-        printf("[NEWFS] Error: Failed to write data bitmap\n");
+        newfs_print_stats();
     }
 
     /******************************************************************************
-     * SECTION: 5. 释放内存
+     * SECTION: 3. 释放内存
      ******************************************************************************/
     free(super.map_inode);
     free(super.map_data);
+    free(super.groups);
+    free(super.free_pending);
+    super.free_pending = NULL;
+    super.free_pending_cnt = super.free_pending_cap = 0;
+    newfs_pcache_destroy();
+    newfs_cache_destroy();
+    newfs_dcache_destroy();
 
     /******************************************************************************
-     * SECTION: 6. 关闭驱动
+     * SECTION: 4. 关闭驱动
      ******************************************************************************/
     ddriver_close(super.fd);
 
     super.is_mounted = false;
+    pthread_mutex_destroy(&super.lock);
+    pthread_cond_destroy(&super.flush_cond);
 
     return;
 }
@@ -313,32 +521,44 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	(void)mode;
 	bool is_find, is_root;
 	char* fname;
-	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry* last_dentry;
 	struct newfs_dentry* dentry;
+	int ret = NFS_ERROR_NONE;
 
+	NFS_LOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find) {
-		return -NFS_ERROR_EXISTS;
+		ret = -NFS_ERROR_EXISTS;
 	}
-
-	if (last_dentry == NULL) {
-		return -NFS_ERROR_NOTFOUND;
+	else if (last_dentry == NULL || last_dentry->inode == NULL) {
+		ret = -NFS_ERROR_NOTFOUND;
 	}
-
-	if (last_dentry->inode == NULL) {
-		return -NFS_ERROR_NOTFOUND;
+	else if (NFS_IS_REG(last_dentry->inode)) {
+		ret = -NFS_ERROR_UNSUPPORTED;
 	}
-
-	if (NFS_IS_REG(last_dentry->inode)) {
-		return -NFS_ERROR_UNSUPPORTED;
+	else if (!NFS_DIR_HAS_ROOM(last_dentry->inode)
+			 || newfs_dir_reserve(last_dentry->inode, 1) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_NOSPACE;
 	}
-
-	fname  = newfs_get_fname(path);
-	dentry = newfs_alloc_dentry(fname, NFS_DIR); 
-	dentry->parent = last_dentry;
-	newfs_alloc_inode(dentry);
-	newfs_alloc_dentry_to_inode(last_dentry->inode, dentry);
+	else {
+		fname  = newfs_get_fname(path);
+		dentry = newfs_alloc_dentry(fname, NFS_DIR); 
+		dentry->parent = last_dentry;
+		if (newfs_alloc_inode(dentry) == NULL) {
+			free(dentry);
+			newfs_dir_reserve(last_dentry->inode, 0);
+			ret = -NFS_ERROR_NOSPACE;
+		}
+		else {
+			newfs_alloc_dentry_to_inode(last_dentry->inode, dentry);
+			newfs_mark_inode_dirty(last_dentry->inode);
+			newfs_dcache_invalidate(path);
+			newfs_flush_if_needed();
+		}
+	}
+	NFS_UNLOCK();
 	
-	return NFS_ERROR_NONE;
+	return ret;
 }
 
 /**
@@ -350,21 +570,28 @@ int newfs_mkdir(const char* path, mode_t mode) {
  */
 int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	bool is_find, is_root;
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-	
+	struct newfs_dentry* dentry;
+
+	NFS_LOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find == false) {
+		NFS_UNLOCK();
 		return -NFS_ERROR_NOTFOUND;
 	}
 
 	/* 根据文件类型填充 stat 结构 */
 	if (NFS_IS_DIR(dentry->inode)) {
 		newfs_stat->st_mode = S_IFDIR | 0777;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
+		newfs_stat->st_size = dentry->inode->size;	/* 目录项占用的块，写回时更新 */
 	}
 	else if (NFS_IS_REG(dentry->inode)) {
 		newfs_stat->st_mode = S_IFREG | 0777;
 		newfs_stat->st_size = dentry->inode->size;
 	}
+	else if (NFS_IS_SYM_LINK(dentry->inode)) {
+		newfs_stat->st_mode = S_IFLNK | 0777;
+		newfs_stat->st_size = dentry->inode->size;
+	}
 
 	newfs_stat->st_nlink = 1;
 	newfs_stat->st_uid = getuid();
@@ -379,6 +606,7 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 		newfs_stat->st_blocks = super.sz_disk / NFS_IO_SZ();
 		newfs_stat->st_nlink = 2;  /* 根目录 link 数为 2 */
 	}
+	NFS_UNLOCK();
 
 	return NFS_ERROR_NONE;
 }
@@ -398,27 +626,48 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  * 
  * @param offset 第几个目录项？
- * @param fi 可忽略
+ * @param fi newfs_opendir 分配的游标保存在 fi->fh 中，为空时从头定位
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
 	bool is_find, is_root;
-	int cur_dir = offset;
-
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* sub_dentry;
+	struct newfs_dir_cursor* cursor = fi ? (struct newfs_dir_cursor*)(uintptr_t)fi->fh : NULL;
+	struct newfs_dir_cursor tmp_cursor;
+	struct newfs_dentry* dentry;
 	struct newfs_inode* inode;
 	
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->name, NULL, ++offset);
+	NFS_LOCK();
+	if (cursor == NULL) {
+		/* 没有经过 opendir，用临时游标 */
+		dentry = newfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			NFS_UNLOCK();
+			return -NFS_ERROR_NOTFOUND;
 		}
-		return NFS_ERROR_NONE;
+		cursor = &tmp_cursor;
+		cursor->inode = dentry->inode;
+		cursor->offset = -1;
+	}
+	inode = cursor->inode;
+
+	/* 只有 seekdir/rewinddir 或目录项被移除后才需要从头重新定位 */
+	if (cursor->offset != offset || cursor->dir_gen != inode->dir_gen) {
+		cursor->next = newfs_get_dentry(inode, offset);
+		cursor->offset = offset;
+		cursor->dir_gen = inode->dir_gen;
+	}
+
+	/* 一次填满 FUSE 缓冲区，filler 返回非 0 表示已满，该项留到下次 */
+	while (cursor->next) {
+		if (filler(buf, cursor->next->name, NULL, cursor->offset + 1)) {
+			break;
+		}
+		cursor->next = cursor->next->brother;
+		cursor->offset++;
 	}
-	return -NFS_ERROR_NOTFOUND;
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
 }
 
 /**
@@ -431,39 +680,54 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
  */
 int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	bool is_find, is_root;
-	
-	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry* last_dentry;
 	struct newfs_dentry* dentry;
 	char* fname;
+	int ret = NFS_ERROR_NONE;
 	
+	NFS_LOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find == true) {
-		return -NFS_ERROR_EXISTS;
-	}
-
-	if (last_dentry == NULL) {
-		return -NFS_ERROR_NOTFOUND;
-	}
-
-	if (last_dentry->inode == NULL) {
-		return -NFS_ERROR_NOTFOUND;
+		ret = -NFS_ERROR_EXISTS;
 	}
-
-	fname = newfs_get_fname(path);
-	
-	if (S_ISREG(mode)) {
-		dentry = newfs_alloc_dentry(fname, NFS_REG_FILE);
+	else if (last_dentry == NULL || last_dentry->inode == NULL) {
+		ret = -NFS_ERROR_NOTFOUND;
 	}
-	else if (S_ISDIR(mode)) {
-		dentry = newfs_alloc_dentry(fname, NFS_DIR);
+	else if (!NFS_DIR_HAS_ROOM(last_dentry->inode)
+			 || newfs_dir_reserve(last_dentry->inode, 1) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_NOSPACE;
 	}
 	else {
-		dentry = newfs_alloc_dentry(fname, NFS_REG_FILE);
+		fname = newfs_get_fname(path);
+		
+		if (S_ISREG(mode)) {
+			dentry = newfs_alloc_dentry(fname, NFS_REG_FILE);
+		}
+		else if (S_ISDIR(mode)) {
+			dentry = newfs_alloc_dentry(fname, NFS_DIR);
+		}
+		else if (S_ISLNK(mode)) {
+			dentry = newfs_alloc_dentry(fname, NFS_SYM_LINK);
+		}
+		else {
+			dentry = newfs_alloc_dentry(fname, NFS_REG_FILE);
+		}
+		dentry->parent = last_dentry;
+		if (newfs_alloc_inode(dentry) == NULL) {
+			free(dentry);
+			newfs_dir_reserve(last_dentry->inode, 0);
+			ret = -NFS_ERROR_NOSPACE;
+		}
+		else {
+			newfs_alloc_dentry_to_inode(last_dentry->inode, dentry);
+			newfs_mark_inode_dirty(last_dentry->inode);
+			newfs_dcache_invalidate(path);
+			newfs_flush_if_needed();
+		}
 	}
-	dentry->parent = last_dentry;
-	newfs_alloc_inode(dentry);
-	newfs_alloc_dentry_to_inode(last_dentry->inode, dentry);
+	NFS_UNLOCK();
 
-	return NFS_ERROR_NONE;
+	return ret;
 }
 
 /**
@@ -492,10 +756,129 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
  */
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
+	bool is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_inode* inode;
+	int ret;
+
+	NFS_LOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == false) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (NFS_IS_DIR(inode)) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_INVAL;
+	}
+	if (offset < 0 || offset + (long long)size > super.file_max) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOSPACE;
+	}
+
+	ret = newfs_file_write(inode, (int)offset, (const uint8_t *)buf, (int)size);
+	if (ret != NFS_ERROR_NONE) {
+		NFS_UNLOCK();
+		return ret;
+	}
+	newfs_flush_if_needed();
+	NFS_UNLOCK();
 	return size;
 }
 
+/**
+ * @brief 把内联数据搬进页缓存，文件改为使用数据块
+ *
+ * 数据成为页缓存中逻辑块 0 的脏页，与普通写入一样在写回时分配物理块
+ */
+static int newfs_inline_promote(struct newfs_inode* inode) {
+	int ret = NFS_ERROR_NONE;
+
+	if (inode->size > 0) {
+		ret = newfs_pcache_write(inode, 0, inode->inline_data, inode->size);
+	}
+	if (ret == NFS_ERROR_NONE) {
+		memset(inode->inline_data, 0, NFS_INLINE_MAX);
+		inode->is_inline = false;
+	}
+	return ret;
+}
+
+/**
+ * @brief 写文件内容：结果不超过 NFS_INLINE_MAX 字节的内联文件直接改 inode，
+ * 否则先转为使用数据块再写入页缓存。文件大小随之更新，inode 标脏
+ */
+static int newfs_file_write(struct newfs_inode* inode, int offset, const uint8_t* buf, int size) {
+	int ret;
+
+	if (inode->is_inline && offset + size <= NFS_INLINE_MAX) {
+		memcpy(inode->inline_data + offset, buf, size);
+	}
+	else {
+		if (inode->is_inline && (ret = newfs_inline_promote(inode)) != NFS_ERROR_NONE) {
+			return ret;
+		}
+		/* 数据只进入页缓存，由 newfs_flush 在提交元数据之前分配物理块并写回 */
+		ret = newfs_pcache_write(inode, offset, buf, size);
+		if (ret != NFS_ERROR_NONE) {
+			return ret;
+		}
+	}
+	if (offset + size > (int)inode->size) {
+		inode->size = offset + size;
+	}
+	newfs_mark_inode_dirty(inode);
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读文件内容，调用者保证 [offset, offset + size) 不超出文件大小
+ */
+static int newfs_file_read(struct newfs_inode* inode, int offset, uint8_t* buf, int size) {
+	if (inode->is_inline) {
+		memcpy(buf, inode->inline_data + offset, size);
+		return NFS_ERROR_NONE;
+	}
+	return newfs_pcache_read(inode, offset, buf, size);
+}
+
+/**
+ * @brief 读文件前的预读：本次要读的块 [first, last] 与预读块一次批量读入
+ *
+ * 本次从上次读到的块（或其下一块）开始时视为顺序读：
+ * 已预读的块剩余不到半个窗口时，窗口翻倍（不超过 NFS_RA_MAX_BLKS）并继续向后预读。
+ * 随机读把窗口恢复为初始值，只批量读入本次请求本身
+ */
+static void newfs_readahead(struct newfs_file* file, struct newfs_inode* inode, int first, int last) {
+	int nblks = (inode->size + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
+	int start = first, end = last + 1;
+
+	if (first == file->ra_next || first == file->ra_next - 1) {
+		if (file->ra_end - end >= file->ra_window / 2) {
+			file->ra_next = last + 1;             /* 已预读的块还够用 */
+			return;
+		}
+		start = file->ra_end > first ? file->ra_end : first;
+		end = last + 1 + file->ra_window;
+		if (file->ra_window < NFS_RA_MAX_BLKS) {
+			file->ra_window *= 2;
+		}
+	}
+	else {
+		file->ra_window = NFS_RA_MIN_BLKS;
+	}
+
+	if (end > nblks) {
+		end = nblks;
+	}
+	if (start < end) {
+		newfs_pcache_readahead(inode, start, end - start);
+	}
+	file->ra_end = end > last + 1 ? end : last + 1;
+	file->ra_next = last + 1;
+}
+
 /**
  * @brief 读取文件
  * 
@@ -508,8 +891,37 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
  */
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	bool is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_inode* inode;
+	int ret;
+
+	NFS_LOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == false) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (NFS_IS_DIR(inode)) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_INVAL;
+	}
+	if (offset < 0 || offset >= inode->size) {
+		NFS_UNLOCK();
+		return 0;
+	}
+	if (offset + size > inode->size) {
+		size = inode->size - offset;
+	}
+
+	if (fi != NULL && fi->fh != 0 && !inode->is_inline) {
+		newfs_readahead((struct newfs_file*)(uintptr_t)fi->fh, inode,
+		                offset / NFS_BLKS_SZ(), (offset + size - 1) / NFS_BLKS_SZ());
+	}
+	ret = newfs_file_read(inode, (int)offset, (uint8_t *)buf, (int)size);
+	NFS_UNLOCK();
+	return ret == NFS_ERROR_NONE ? (int)size : ret;
 }
 
 /**
@@ -561,8 +973,32 @@ int newfs_rename(const char* from, const char* to) {
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	struct newfs_file* file;
+
+	(void)path;
+	file = (struct newfs_file*)malloc(sizeof(struct newfs_file));
+	if (file == NULL) {
+		return -NFS_ERROR_NOSPACE;
+	}
+	file->ra_next = 0;
+	file->ra_window = NFS_RA_MIN_BLKS;
+	file->ra_end = 0;
+	fi->fh = (uint64_t)(uintptr_t)file;
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭文件，释放 open 分配的预读状态
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	(void)path;
+	free((struct newfs_file*)(uintptr_t)fi->fh);
+	fi->fh = 0;
+	return NFS_ERROR_NONE;
 }
 
 /**
@@ -573,48 +1009,288 @@ int newfs_open(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	bool is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_dir_cursor* cursor;
+
+	NFS_LOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOTFOUND;
+	}
+	if (!NFS_IS_DIR(dentry->inode)) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_INVAL;
+	}
+
+	cursor = (struct newfs_dir_cursor*)malloc(sizeof(struct newfs_dir_cursor));
+	if (cursor == NULL) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOSPACE;
+	}
+	cursor->inode = dentry->inode;
+	cursor->next = dentry->inode->dentrys;
+	cursor->offset = 0;
+	cursor->dir_gen = dentry->inode->dir_gen;
+	fi->fh = (uint64_t)(uintptr_t)cursor;
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 改变文件大小
+ * @brief 关闭目录文件，释放 opendir 分配的游标
  * 
  * @param path 相对于挂载点的路径
- * @param offset 改变后文件大小
+ * @param fi 文件信息
  * @return int 0成功，否则返回对应错误号
  */
-int newfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+int newfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	free((struct newfs_dir_cursor*)(uintptr_t)fi->fh);
+	fi->fh = 0;
+	return NFS_ERROR_NONE;
 }
 
-
 /**
- * @brief 访问文件，因为读写文件时需要查看权限
+ * @brief 改变文件大小
  * 
  * @param path 相对于挂载点的路径
- * @param type 访问类别
- * R_OK: Test for read permission. 
- * W_OK: Test for write permission.
- * X_OK: Test for execute permission.
- * F_OK: Test for existence. 
- * 
+ * @param offset 改变后文件大小
  * @return int 0成功，否则返回对应错误号
  */
-int newfs_access(const char* path, int type) {
-	/* 选做: 解析路径，判断是否存在 */
-	return 0;
-}	
-/******************************************************************************
-* SECTION: FUSE入口
-*******************************************************************************/
-int main(int argc, char **argv)
-{
-    int ret;
-	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+int newfs_truncate(const char* path, off_t offset) {
+	bool is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_inode* inode;
+	int ret;
 
-    newfs_options.device = strdup("/home/li/user-land-filesystem/driver/user_ddriver/bin/ddriver");
+	NFS_LOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == false) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (NFS_IS_DIR(inode)) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_INVAL;
+	}
+	if (offset < 0 || offset > super.file_max) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOSPACE;
+	}
+
+	if (inode->is_inline && offset <= NFS_INLINE_MAX) {
+		/* 内联数据在 size 之后保持全 0 */
+		if (offset < inode->size) {
+			memset(inode->inline_data + offset, 0, inode->size - offset);
+		}
+		ret = NFS_ERROR_NONE;
+	}
+	else if (inode->is_inline && (ret = newfs_inline_promote(inode)) != NFS_ERROR_NONE) {
+		NFS_UNLOCK();
+		return ret;
+	}
+	else {
+		/* 扩大文件不分配块，文件末尾之后未映射的块读作 0 */
+		int keep = (offset + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
+		int end = (inode->size + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
+
+		ret = newfs_pcache_truncate(inode, (int)offset);
+		/* 从文件末尾分段释放，每段之后文件停在段首，弄脏的位图块和间接块不会超出一个日志事务 */
+		while (ret == NFS_ERROR_NONE && end > keep) {
+			int start = end - NFS_TRUNC_CHUNK > keep ? end - NFS_TRUNC_CHUNK : keep;
+
+			ret = newfs_unmap_blocks(inode, start);
+			if (ret == NFS_ERROR_NONE && start > keep) {
+				inode->size = start * NFS_BLKS_SZ();
+				newfs_mark_inode_dirty(inode);
+				newfs_flush_if_needed();
+			}
+			end = start;
+		}
+		if (ret == NFS_ERROR_NONE && offset == 0) {
+			inode->is_inline = true;	/* 块已全部释放，重新从内联开始 */
+		}
+	}
+	if (ret == NFS_ERROR_NONE) {
+		inode->size = offset;
+		newfs_mark_inode_dirty(inode);
+		newfs_flush_if_needed();
+	}
+	NFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 同步文件：写回所有脏页和元数据，再让驱动把数据写到介质
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非 0 时只要求数据落盘，这里同样刷写元数据
+ * @param fi 可忽略
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	int ret;
+
+	(void)path;
+	(void)datasync;
+	NFS_LOCK();
+	ret = newfs_flush();
+	if (ret == NFS_ERROR_NONE && ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SYNC, NULL) < 0) {
+		ret = -NFS_ERROR_IO;
+	}
+	NFS_UNLOCK();
+	return ret;
+}
+
+
+/**
+ * @brief 访问文件，因为读写文件时需要查看权限
+ * 
+ * @param path 相对于挂载点的路径
+ * @param type 访问类别
+ * R_OK: Test for read permission. 
+ * W_OK: Test for write permission.
+ * X_OK: Test for execute permission.
+ * F_OK: Test for existence. 
+ * 
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_access(const char* path, int type) {
+	/* 选做: 解析路径，判断是否存在 */
+	return 0;
+}	
+
+/**
+ * @brief 查询文件系统容量，返回位图分配器维护的空闲计数，扣除延迟分配预留的块
+ * 
+ * @param path 相对于挂载点的路径，可忽略
+ * @param stbuf 容量信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_statfs(const char* path, struct statvfs* stbuf) {
+	(void)path;
+	memset(stbuf, 0, sizeof(struct statvfs));
+
+	NFS_LOCK();
+	stbuf->f_bsize = NFS_BLKS_SZ();
+	stbuf->f_frsize = NFS_BLKS_SZ();
+	stbuf->f_blocks = super.data_blks;
+	stbuf->f_bfree = newfs_pcache_free_blks();	/* 扣除延迟分配预留的块 */
+	stbuf->f_bavail = stbuf->f_bfree;
+	stbuf->f_files = super.max_ino;
+	stbuf->f_ffree = super.ino_free;
+	stbuf->f_favail = super.ino_free;
+	stbuf->f_namemax = MAX_NAME_LEN - 1;
+	NFS_UNLOCK();
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 创建符号链接，目标路径作为链接的文件内容保存，不超过 NFS_INLINE_MAX 时内联在 inode 中
+ * 
+ * @param target 链接指向的路径
+ * @param path 相对于挂载点的链接路径
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_symlink(const char* target, const char* path) {
+	bool is_find, is_root;
+	struct newfs_dentry* last_dentry;
+	struct newfs_dentry* dentry;
+	struct newfs_inode* inode;
+	int ret = NFS_ERROR_NONE;
+
+	if (strlen(target) > (size_t)super.file_max) {
+		return -NFS_ERROR_NOSPACE;
+	}
+
+	/* 创建 inode、写入目标、挂入父目录在一次持锁内完成，写入失败时不留下空链接 */
+	NFS_LOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find) {
+		ret = -NFS_ERROR_EXISTS;
+	}
+	else if (last_dentry == NULL || last_dentry->inode == NULL) {
+		ret = -NFS_ERROR_NOTFOUND;
+	}
+	else if (!NFS_DIR_HAS_ROOM(last_dentry->inode)
+			 || newfs_dir_reserve(last_dentry->inode, 1) != NFS_ERROR_NONE) {
+		ret = -NFS_ERROR_NOSPACE;
+	}
+	else if ((dentry = newfs_alloc_dentry(newfs_get_fname(path), NFS_SYM_LINK)) == NULL) {
+		ret = -NFS_ERROR_NOSPACE;
+	}
+	else {
+		dentry->parent = last_dentry;
+		inode = newfs_alloc_inode(dentry);
+		if (inode == NULL) {
+			ret = -NFS_ERROR_NOSPACE;
+		}
+		else if ((ret = newfs_file_write(inode, 0, (const uint8_t*)target, strlen(target))) != NFS_ERROR_NONE) {
+			newfs_free_inode(inode);
+		}
+		if (ret != NFS_ERROR_NONE) {
+			free(dentry);
+			newfs_dir_reserve(last_dentry->inode, 0);
+		}
+		else {
+			newfs_alloc_dentry_to_inode(last_dentry->inode, dentry);
+			newfs_mark_inode_dirty(last_dentry->inode);
+			newfs_dcache_invalidate(path);
+			newfs_flush_if_needed();
+		}
+	}
+	NFS_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 读取符号链接的目标路径
+ * 
+ * @param path 相对于挂载点的链接路径
+ * @param buf 输出目标路径，以 0 结尾，超出 size 的部分截断
+ * @param size buf 大小
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_readlink(const char* path, char* buf, size_t size) {
+	bool is_find, is_root;
+	struct newfs_dentry* dentry;
+	int len, ret;
+
+	if (size == 0) {
+		return -NFS_ERROR_INVAL;
+	}
+	NFS_LOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_NOTFOUND;
+	}
+	if (!NFS_IS_SYM_LINK(dentry->inode)) {
+		NFS_UNLOCK();
+		return -NFS_ERROR_INVAL;
+	}
+	len = dentry->inode->size < size - 1 ? (int)dentry->inode->size : (int)size - 1;
+	ret = newfs_file_read(dentry->inode, 0, (uint8_t*)buf, len);
+	buf[ret == NFS_ERROR_NONE ? len : 0] = '\0';
+	NFS_UNLOCK();
+	return ret;
+}
+/******************************************************************************
+* SECTION: FUSE入口
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+    int ret;
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    newfs_options.device = strdup("/home/li/user-land-filesystem/driver/user_ddriver/bin/ddriver");
+    newfs_options.cache_blks = NFS_CACHE_DEFAULT_BLKS;
+    newfs_options.io_sched = NFS_IO_SCHED_DEFAULT;
+    newfs_options.flush_interval = NFS_FLUSH_INTERVAL;
+    newfs_options.page_blks = NFS_PCACHE_DEFAULT_PAGES;
+    newfs_options.stats = 0;
 
     if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
@@ -624,87 +1300,75 @@ int main(int argc, char **argv)
 	return ret;
 }
 
-/* 辅助函数：读取一个逻辑块（分两次读取 512B） */
+/**
+ * @brief 读取一个逻辑块（经过块缓存）
+ */
 int newfs_read_block(int fd, int block_no, uint8_t *buf) {
-    int ret;
-    int offset = block_no * NFS_BLKS_SZ();
-    
-    /* 第一次读取前 512B */
-    ret = ddriver_seek(fd, offset, SEEK_SET);
-    if (ret < 0) return ret;
-    ret = ddriver_read(fd, buf, NFS_IO_SZ());
-    if (ret < 0) return ret;
-    
-    /* 第二次读取后 512B */
-    ret = ddriver_seek(fd, offset + NFS_IO_SZ(), SEEK_SET);
-    if (ret < 0) return ret;
-    ret = ddriver_read(fd, buf + NFS_IO_SZ(), NFS_IO_SZ());
-    
-    return ret;
+    uint8_t *data = newfs_cache_get(block_no, 0, NFS_BLKS_SZ(), false);
+    (void)fd;
+
+    if (data == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(buf, data, NFS_BLKS_SZ());
+    return NFS_ERROR_NONE;
 }
 
-/* 辅助函数：写入一个逻辑块（分两次写入 512B） */
+/**
+ * @brief 写入一个逻辑块（写入块缓存，sync/umount 时刷回）
+ */
 int newfs_write_block(int fd, int block_no, uint8_t *buf) {
-    int ret;
-    int offset = block_no * NFS_BLKS_SZ();
-    
-    /* 第一次写入前 512B */
-    ret = ddriver_seek(fd, offset, SEEK_SET);
-    if (ret < 0) return ret;
-    ret = ddriver_write(fd, buf, NFS_IO_SZ());
-    if (ret < 0) return ret;
-    
-    /* 第二次写入后 512B */
-    ret = ddriver_seek(fd, offset + NFS_IO_SZ(), SEEK_SET);
-    if (ret < 0) return ret;
-    ret = ddriver_write(fd, buf + NFS_IO_SZ(), NFS_IO_SZ());
-    
-    return ret;
+    uint8_t *data = newfs_cache_get(block_no, 0, NFS_BLKS_SZ(), true);
+    (void)fd;
+
+    if (data == NULL) {
+        return -NFS_ERROR_IO;
+    }
+    memcpy(data, buf, NFS_BLKS_SZ());
+    return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 驱动读（处理对齐）
+ * @brief 驱动读（按块经过缓存，处理对齐）
  */
-int newfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
-    int bias = offset - offset_aligned;
-    int size_aligned = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    while (size_aligned != 0) {
-        ddriver_read(super.fd, cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+int newfs_driver_read(off_t offset, uint8_t *out_content, int size) {
+    while (size > 0) {
+        int block_no = offset / NFS_BLKS_SZ();
+        int bias = offset % NFS_BLKS_SZ();
+        int len = NFS_BLKS_SZ() - bias < size ? NFS_BLKS_SZ() - bias : size;
+        uint8_t *data = newfs_cache_get(block_no, bias, len, false);
+
+        if (data == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(out_content, data + bias, len);
+        out_content += len;
+        offset += len;
+        size -= len;
     }
-    
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
     return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 驱动写（处理对齐）
+ * @brief 驱动写（按块写入缓存，处理对齐）
+ *
+ * 只有被部分覆盖的首尾扇区需要预读，整扇区写入不会产生读 I/O
  */
-int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int offset_aligned = NFS_ROUND_DOWN(offset, NFS_IO_SZ());
-    int bias = offset - offset_aligned;
-    int size_aligned = NFS_ROUND_UP((size + bias), NFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    while (size_aligned != 0) {
-        ddriver_write(super.fd, cur, NFS_IO_SZ());
-        cur += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();
+int newfs_driver_write(off_t offset, uint8_t *in_content, int size) {
+    while (size > 0) {
+        int block_no = offset / NFS_BLKS_SZ();
+        int bias = offset % NFS_BLKS_SZ();
+        int len = NFS_BLKS_SZ() - bias < size ? NFS_BLKS_SZ() - bias : size;
+        uint8_t *data = newfs_cache_get(block_no, bias, len, true);
+
+        if (data == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(data + bias, in_content, len);
+        in_content += len;
+        offset += len;
+        size -= len;
     }
-    
-    free(temp_content);
     return NFS_ERROR_NONE;
 }
 
@@ -744,8 +1408,23 @@ struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
 
 	memset(inode, 0, sizeof(struct newfs_inode));
 
-	/* 分配 inode 编号 */
-	int ino = newfs_alloc_ino();
+	/* 分配 inode 编号：文件跟随父目录所在的组，目录放到空闲 inode 最多的组以分散负载 */
+	int group = 0;
+	if (dentry->parent != NULL)
+	{
+		group = NFS_INO_GROUP(dentry->parent->ino);
+		if (dentry->ftype == NFS_DIR)
+		{
+			for (int g = 0; g < super.group_cnt; g++)
+			{
+				if (super.groups[g].ino_free > super.groups[group].ino_free)
+				{
+					group = g;
+				}
+			}
+		}
+	}
+	int ino = newfs_alloc_ino(group);
 	if (ino == -1)
 	{
 		free(inode);
@@ -756,187 +1435,1053 @@ struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
 	inode->size = 0;
 	inode->dir_cnt = 0;
 	inode->ftype = dentry->ftype;  /* 使用 dentry 的文件类型 */
-	memset(inode->target_path, 0, MAX_NAME_LEN);
+	memset(inode->inline_data, 0, NFS_INLINE_MAX);
+	inode->is_inline = !NFS_IS_DIR(inode);  /* 文件和符号链接从内联开始 */
 	inode->dentry = dentry;
 	inode->dentrys = NULL;
-	inode->data = NULL;  /* 初始化数据缓存指针 */
+	inode->pages = NULL;  /* 还没有缓存页 */
+	inode->pages_sz = 0;
+	inode->page_cnt = 0;
+	inode->delalloc_cnt = 0;
+	inode->resv_blks = 0;
 
 	/* 初始化数据块指针为 0（未分配） */
 	for (int i = 0; i < NFS_DATA_PER_FILE; i++)
 	{
 		inode->block_pointer[i] = 0;
 	}
+	for (int i = 0; i < NFS_IND_LEVELS; i++)
+	{
+		inode->indirect[i] = 0;
+	}
+	inode->bmap_leaf = 0;
+
+	dentry->ino = ino;
+	dentry->inode = inode;
+	newfs_mark_inode_dirty(inode);
+
+	return inode;
+}
+
+/**
+ * @brief 释放一个刚分配、还没有刷写过也没有挂入目录的 inode
+ *
+ * 丢弃其缓存页、释放数据块并归还 inode 编号，用于创建中途失败时的回滚
+ */
+static void newfs_free_inode(struct newfs_inode *inode)
+{
+	struct newfs_group *grp = &super.groups[NFS_INO_GROUP(inode->ino)];
+	int ino = inode->ino % super.inos_per_group;
+
+	newfs_clear_inode_dirty(inode);
+	if (!inode->is_inline)
+	{
+		newfs_pcache_truncate(inode, 0);
+		newfs_unmap_blocks(inode, 0);
+	}
+	if (newfs_bitmap_free(grp->map_inode, ino))
+	{
+		grp->ino_free++;
+		super.ino_free++;
+	}
+	NFS_MAP_DIRTY(grp->ino_map_dirty_lo, grp->ino_map_dirty_hi, ino / 8);
+	if (inode->dentry)
+	{
+		inode->dentry->inode = NULL;
+	}
+	free(inode);
+}
+
+/**
+ * @brief 按超级块中的分组参数计算第 g 组的布局
+ */
+static void newfs_group_layout(const struct newfs_super_d *super_d, int g, struct newfs_group *group)
+{
+    int start = g * super_d->blks_per_group;
+    int end = start + super_d->blks_per_group;
+    int disk_end = super_d->journal_offset;
+
+    memset(group, 0, sizeof(struct newfs_group));
+    if (g == 0)
+    {
+        group->ino_bitmap_offset = super_d->ino_bitmap_offset;
+        group->data_bitmap_offset = super_d->data_bitmap_offset;
+        group->inode_offset = super_d->inode_offset;
+    }
+    else
+    {
+        group->ino_bitmap_offset = start;
+        group->data_bitmap_offset = start + 1;
+        group->inode_offset = start + 2;
+    }
+    group->data_offset = group->inode_offset + super_d->inode_blks;
+    group->data_blks = (end < disk_end ? end : disk_end) - group->data_offset;
+}
+
+/**
+ * @brief 建立内存中的块组，各组位图依次放在 super.map_inode / super.map_data 中
+ */
+static int newfs_group_init(const struct newfs_super_d *super_d)
+{
+    super.groups = (struct newfs_group *)calloc(super.group_cnt, sizeof(struct newfs_group));
+    super.map_inode = (uint8_t *)malloc((size_t)super.group_cnt * NFS_BLKS_SZ());
+    super.map_data = (uint8_t *)malloc((size_t)super.group_cnt * NFS_BLKS_SZ());
+    if (super.groups == NULL || super.map_inode == NULL || super.map_data == NULL)
+    {
+        free(super.groups);
+        free(super.map_inode);
+        free(super.map_data);
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    for (int g = 0; g < super.group_cnt; g++)
+    {
+        struct newfs_group *group = &super.groups[g];
+
+        newfs_group_layout(super_d, g, group);
+        group->map_inode = super.map_inode + (size_t)g * NFS_BLKS_SZ();
+        group->map_data = super.map_data + (size_t)g * NFS_BLKS_SZ();
+    }
+    super.data_group = 0;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 分配一个 inode 编号
+ *
+ * @param group 优先从该组分配，组满时依次尝试后面的组
+ */
+int newfs_alloc_ino(int group)
+{
+	for (int k = 0; k < super.group_cnt; k++)
+	{
+		int g = (group + k) % super.group_cnt;
+		struct newfs_group *grp = &super.groups[g];
+		int ino;
+
+		if (grp->ino_free == 0)
+		{
+			continue;
+		}
+		ino = newfs_bitmap_alloc(grp->map_inode, super.inos_per_group, &grp->ino_hint);
+		if (ino == -1)
+		{
+			continue;
+		}
+
+		grp->ino_free--;
+		super.ino_free--;
+		NFS_MAP_DIRTY(grp->ino_map_dirty_lo, grp->ino_map_dirty_hi, ino / 8);
+		return g * super.inos_per_group + ino;
+	}
+	return -1; // 没有空闲 inode
+}
+
+/**
+ * @brief 分配一个数据块
+ */
+int newfs_alloc_data_block() {
+    int got;
+    return newfs_alloc_data_blocks(-1, 1, &got);
+}
+
+/**
+ * @brief 分配一段物理连续的数据块
+ *
+ * 从 goal 所在的组、goal 处开始查找（通常是文件上一块之后的那一块），
+ * goal 无效时从上次分配的组继续；找到空闲块后尽量向后连续占用 want 块，
+ * 本组已满时依次尝试后面的组
+ *
+ * @param goal 期望的起始块号，-1 表示不指定
+ * @param want 希望分配的块数
+ * @param got 实际分配的块数
+ * @return int 第一块的实际块号，没有空闲块返回 -1
+ */
+int newfs_alloc_data_blocks(int goal, int want, int *got) {
+    int g = super.data_group;
+    int goal_idx = -1;
+
+    if (goal >= 0 && NFS_BLK_GROUP(goal) < super.group_cnt) {
+        struct newfs_group *grp = &super.groups[NFS_BLK_GROUP(goal)];
+
+        if (goal >= grp->data_offset && goal < grp->data_offset + grp->data_blks) {
+            g = NFS_BLK_GROUP(goal);
+            goal_idx = goal - grp->data_offset;
+        }
+    }
+
+    for (int k = 0; k < super.group_cnt; k++, g = (g + 1) % super.group_cnt) {
+        struct newfs_group *grp = &super.groups[g];
+        int hint = (k == 0 && goal_idx >= 0) ? goal_idx : grp->data_hint;
+        int blk_idx;
+
+        if (grp->data_free == 0) {
+            continue;
+        }
+        blk_idx = newfs_bitmap_alloc_run(grp->map_data, grp->data_blks, &hint, want, got);
+        if (blk_idx == -1) {
+            continue;
+        }
+
+        grp->data_hint = hint;
+        grp->data_free -= *got;
+        super.data_free -= *got;
+        super.data_group = g;
+        NFS_MAP_DIRTY(grp->data_map_dirty_lo, grp->data_map_dirty_hi, blk_idx / 8);
+        NFS_MAP_DIRTY(grp->data_map_dirty_lo, grp->data_map_dirty_hi, (blk_idx + *got - 1) / 8);
+        return grp->data_offset + blk_idx;  // 返回实际块号
+    }
+    return -1;  // 没有空闲数据块
+}
+
+/**
+ * @brief 计算最大文件大小：直接块加三级间接块可映射的块数，不超过数据区大小
+ *
+ * 文件内偏移和 inode 大小仍是 32 位，超过 2GB 的设备上单个文件不超过 INT_MAX
+ */
+static int newfs_calc_file_max(int data_blks)
+{
+    long long ptrs = NFS_PTRS_PER_BLK();
+    long long blks = NFS_DATA_PER_FILE + ptrs + ptrs * ptrs + ptrs * ptrs * ptrs;
+
+    if (blks > data_blks)
+    {
+        blks = data_blks;
+    }
+    if (blks > INT_MAX / NFS_BLKS_SZ())
+    {
+        blks = INT_MAX / NFS_BLKS_SZ();
+    }
+    return (int)(blks * NFS_BLKS_SZ());
+}
+
+/**
+ * @brief 计算逻辑块在间接块树中的路径（ext2 的 block_to_path）
+ *
+ * @param lblk 逻辑块号，>= NFS_DATA_PER_FILE
+ * @param offsets 每一级间接块中的下标
+ * @return int 间接级数 1~3，超出范围返回 0
+ */
+static int newfs_bmap_path(int lblk, int offsets[NFS_IND_LEVELS])
+{
+    long long ptrs = NFS_PTRS_PER_BLK();
+    long long idx = lblk - NFS_DATA_PER_FILE;
+
+    if (idx < ptrs)
+    {
+        offsets[0] = idx;
+        return 1;
+    }
+    idx -= ptrs;
+    if (idx < ptrs * ptrs)
+    {
+        offsets[0] = idx / ptrs;
+        offsets[1] = idx % ptrs;
+        return 2;
+    }
+    idx -= ptrs * ptrs;
+    if (idx < ptrs * ptrs * ptrs)
+    {
+        offsets[0] = idx / (ptrs * ptrs);
+        offsets[1] = (idx / ptrs) % ptrs;
+        offsets[2] = idx % ptrs;
+        return 3;
+    }
+    return 0;
+}
+
+/**
+ * @brief 估计为逻辑块 [lo, hi] 中的 cnt 个块建立映射最多需要新分配的间接块数
+ *
+ * 每棵间接块树按层统计范围跨越的间接块数，每层不超过 cnt；已分配的顶级间接块不计。
+ * 只看 inode 中的块号、不读间接块，结果是上界
+ */
+int newfs_bmap_meta_blks(struct newfs_inode *inode, int lo, int hi, int cnt)
+{
+    long long ptrs = NFS_PTRS_PER_BLK();
+    long long start = NFS_DATA_PER_FILE, span = ptrs;
+    int blks = 0;
+
+    for (int depth = 1; depth <= NFS_IND_LEVELS; depth++, start += span, span *= ptrs)
+    {
+        long long a, b, unit = span;
+
+        if (hi < start || lo >= start + span)
+        {
+            continue;
+        }
+        a = lo > start ? lo - start : 0;
+        b = hi < start + span - 1 ? hi - start : span - 1;
+        for (int level = 0; level < depth; level++, unit /= ptrs)
+        {
+            long long n = b / unit - a / unit + 1;
+
+            if (level == 0 && inode->indirect[depth - 1] != 0)
+            {
+                continue;
+            }
+            blks += n < cnt ? n : cnt;
+        }
+    }
+    return blks;
+}
+
+/**
+ * @brief 读写间接块中的一个块号（经过块缓存）
+ *
+ * 读失败时返回错误号而不是 0，不能把读不出来的指针当作空洞重新分配
+ */
+static int newfs_bmap_get_ptr(uint32_t blk, int idx, uint32_t *ptr)
+{
+    *ptr = 0;
+    return newfs_driver_read((off_t)blk * NFS_BLKS_SZ() + idx * sizeof(uint32_t), (uint8_t *)ptr, sizeof(uint32_t));
+}
+
+static int newfs_bmap_set_ptr(uint32_t blk, int idx, uint32_t ptr)
+{
+    return newfs_driver_write((off_t)blk * NFS_BLKS_SZ() + idx * sizeof(uint32_t), (uint8_t *)&ptr, sizeof(uint32_t));
+}
+
+/**
+ * @brief 找到逻辑块对应的最末级间接块
+ *
+ * 顺序访问时落在上次的最末级间接块内，不必从树根重新走一遍
+ *
+ * @param lblk 逻辑块号，>= NFS_DATA_PER_FILE
+ * @param create 路径上缺少的间接块是否分配（清零后写入）
+ * @param goal 分配间接块的目标位置
+ * @param idx 逻辑块在最末级间接块中的下标
+ * @return int 最末级间接块的块号，不存在且不分配时返回 0，出错返回负的错误号
+ */
+static int newfs_bmap_leaf(struct newfs_inode *inode, int lblk, bool create, int goal, int *idx)
+{
+    int offsets[NFS_IND_LEVELS];
+    int depth, got, ret;
+    uint32_t blk, parent = 0;
+
+    if (inode->bmap_leaf != 0 && lblk >= inode->bmap_leaf_base &&
+        lblk < inode->bmap_leaf_base + (int)NFS_PTRS_PER_BLK())
+    {
+        *idx = lblk - inode->bmap_leaf_base;
+        return inode->bmap_leaf;
+    }
+
+    depth = newfs_bmap_path(lblk, offsets);
+    if (depth == 0)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    /* 从树根逐级向下，第 level 级块由上一级块中下标 offsets[level - 1] 的块号给出 */
+    blk = inode->indirect[depth - 1];
+    for (int level = 0; level < depth; level++)
+    {
+        if (level > 0)
+        {
+            parent = blk;
+            if ((ret = newfs_bmap_get_ptr(parent, offsets[level - 1], &blk)) != NFS_ERROR_NONE)
+            {
+                return ret;
+            }
+        }
+        if (blk == 0)
+        {
+            uint8_t *zero;
+
+            if (!create)
+            {
+                return 0;
+            }
+            blk = newfs_alloc_data_blocks(goal, 1, &got);
+            if ((int)blk == -1)
+            {
+                return -NFS_ERROR_NOSPACE;
+            }
+            zero = (uint8_t *)calloc(1, NFS_BLKS_SZ());
+            newfs_write_block(super.fd, blk, zero);
+            free(zero);
+
+            if (level == 0)
+            {
+                inode->indirect[depth - 1] = blk;
+            }
+            else if (newfs_bmap_set_ptr(parent, offsets[level - 1], blk) != NFS_ERROR_NONE)
+            {
+                return -NFS_ERROR_IO;
+            }
+        }
+    }
+
+    inode->bmap_leaf = blk;
+    inode->bmap_leaf_base = lblk - offsets[depth - 1];
+    *idx = offsets[depth - 1];
+    return blk;
+}
+
+/**
+ * @brief 逻辑块 -> 物理块
+ *
+ * @return int 物理块号，未映射返回 0，读间接块出错返回负的错误号
+ */
+int newfs_bmap(struct newfs_inode *inode, int lblk) {
+    int leaf, idx, ret;
+    uint32_t ptr;
+
+    if (lblk < NFS_DATA_PER_FILE) {
+        return inode->block_pointer[lblk];
+    }
+    leaf = newfs_bmap_leaf(inode, lblk, false, -1, &idx);
+    if (leaf <= 0) {
+        return leaf;
+    }
+    if ((ret = newfs_bmap_get_ptr(leaf, idx, &ptr)) != NFS_ERROR_NONE) {
+        return ret;
+    }
+    return ptr;
+}
+
+/**
+ * @brief 记录逻辑块 -> 物理块，路径上缺少的间接块一并分配
+ */
+static int newfs_bmap_set(struct newfs_inode *inode, int lblk, int block_no) {
+    int leaf, idx;
+
+    if (lblk < NFS_DATA_PER_FILE) {
+        inode->block_pointer[lblk] = block_no;
+        return NFS_ERROR_NONE;
+    }
+    leaf = newfs_bmap_leaf(inode, lblk, true, block_no + 1, &idx);
+    if (leaf < 0) {
+        return leaf;
+    }
+    return newfs_bmap_set_ptr(leaf, idx, block_no);
+}
+
+/**
+ * @brief 释放间接块树中覆盖 [from, to) 且已经全空的间接块
+ *
+ * @param blk 第 level 级间接块，覆盖从逻辑块 base 开始的 ptrs^level 个逻辑块
+ * @return bool blk 自身是否全空
+ */
+static bool newfs_bmap_prune(uint32_t blk, int level, long long base, long long from, long long to) {
+    long long ptrs = NFS_PTRS_PER_BLK();
+    long long span = 1;
+    bool empty = true;
+
+    for (int l = 1; l < level; l++) {
+        span *= ptrs;
+    }
+    for (int i = 0; i < ptrs; i++) {
+        long long child = base + i * span;
+        uint32_t ptr;
+
+        if (newfs_bmap_get_ptr(blk, i, &ptr) != NFS_ERROR_NONE) {
+            empty = false;                        /* 读不出来的块不能当作空块释放 */
+            continue;
+        }
+        if (ptr != 0 && level > 1 && child < to && child + span > from &&
+            newfs_bmap_prune(ptr, level - 1, child, from, to) &&
+            newfs_bmap_set_ptr(blk, i, 0) == NFS_ERROR_NONE) {
+            newfs_cache_forget(ptr);
+            newfs_free_data_block(ptr);
+            ptr = 0;
+        }
+        if (ptr != 0) {
+            empty = false;
+        }
+    }
+    return empty;
+}
+
+/**
+ * @brief 撤销 newfs_map_blocks 的部分分配
+ *
+ * 解除 fresh 标记的逻辑块的映射并释放其物理块，
+ * 再释放范围内因此变为全空的间接块（包括本次分配的间接块）
+ *
+ * @param fresh 长度为 cnt，fresh[k] 表示逻辑块 lblk + k 是本次映射的
+ */
+static void newfs_map_undo(struct newfs_inode *inode, int lblk, int cnt, const uint8_t *fresh) {
+    long long ptrs = NFS_PTRS_PER_BLK();
+    long long start = NFS_DATA_PER_FILE, span = ptrs;
+
+    for (int k = 0; k < cnt; k++) {
+        int block_no;
+
+        if (!fresh[k] || (block_no = newfs_bmap(inode, lblk + k)) <= 0) {
+            continue;
+        }
+        if (newfs_bmap_set(inode, lblk + k, 0) == NFS_ERROR_NONE) {
+            newfs_free_data_block(block_no);
+        }
+    }
+
+    for (int depth = 1; depth <= NFS_IND_LEVELS; depth++, start += span, span *= ptrs) {
+        uint32_t root = inode->indirect[depth - 1];
+
+        if (root != 0 && lblk < start + span && lblk + cnt > start &&
+            newfs_bmap_prune(root, depth, start, lblk, lblk + cnt)) {
+            inode->indirect[depth - 1] = 0;
+            newfs_cache_forget(root);
+            newfs_free_data_block(root);
+        }
+    }
+    inode->bmap_leaf = 0;
+}
+
+/**
+ * @brief 为 inode 的逻辑块 [lblk, lblk + cnt) 中尚未映射的块分配物理块
+ *
+ * 连续的未映射逻辑块一次申请，目标位置紧接前一个逻辑块的物理块，
+ * 顺序增长的文件因此在磁盘上连续存放。超出直接块的部分经间接块映射。
+ * 中途失败时本次分配的数据块和间接块全部释放，范围内的映射恢复原状。
+ * 调用者负责把 inode 标记为脏
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_map_blocks(struct newfs_inode *inode, int lblk, int cnt) {
+    int i = lblk, ret = NFS_ERROR_NONE;
+    uint8_t *fresh;
+
+    if (lblk < 0 || (long long)(lblk + cnt) * NFS_BLKS_SZ() > super.file_max) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (cnt <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    fresh = (uint8_t *)calloc(cnt, sizeof(uint8_t));
+    if (fresh == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    while (i < lblk + cnt) {
+        int want = 1, got, goal = -1, block_no, prev, j;
+
+        if ((block_no = newfs_bmap(inode, i)) != 0) {
+            if (block_no < 0) {
+                ret = block_no;
+                break;
+            }
+            i++;
+            continue;
+        }
+        /* 映射查询出错的块不并入本段，下一轮单独处理时报错 */
+        while (i + want < lblk + cnt && newfs_bmap(inode, i + want) == 0) {
+            want++;
+        }
+        prev = i > 0 ? newfs_bmap(inode, i - 1) : 0;
+        if (prev > 0) {
+            goal = prev + 1;
+        }
+        else {
+            /* 文件的第一块放在 inode 所在的组 */
+            struct newfs_group *grp = &super.groups[NFS_INO_GROUP(inode->ino)];
+            goal = grp->data_offset + grp->data_hint;
+        }
+
+        block_no = newfs_alloc_data_blocks(goal, want, &got);
+        if (block_no == -1) {
+            ret = -NFS_ERROR_NOSPACE;
+            break;
+        }
+        for (j = 0; j < got; j++) {
+            ret = newfs_bmap_set(inode, i + j, block_no + j);
+            if (ret != NFS_ERROR_NONE) {
+                break;
+            }
+            fresh[i + j - lblk] = 1;
+        }
+        if (ret != NFS_ERROR_NONE) {
+            for (; j < got; j++) {
+                newfs_free_data_block(block_no + j);   /* 已申请但未映射的块 */
+            }
+            break;
+        }
+        i += got;
+    }
+
+    if (ret != NFS_ERROR_NONE) {
+        newfs_map_undo(inode, lblk, cnt, fresh);
+    }
+    free(fresh);
+    return ret;
+}
+
+/**
+ * @brief 释放一个数据块
+ *
+ * 块先记入待释放集合，位图和空闲计数在下一个日志事务提交后才更新：
+ * 提交之前磁盘上的旧元数据仍引用这个块，提前复用会让新数据覆盖崩溃后可见的内容
+ */
+void newfs_free_data_block(int block_no) {
+    if (block_no < 0 || NFS_BLK_GROUP(block_no) >= super.group_cnt) {
+        return;  // 无效的块号
+    }
+
+    struct newfs_group *grp = &super.groups[NFS_BLK_GROUP(block_no)];
+    if (block_no < grp->data_offset || block_no >= grp->data_offset + grp->data_blks) {
+        return;  // 不在数据区
+    }
+    
+    int blk_idx = block_no - grp->data_offset;
+
+    if (super.free_pending_cnt == super.free_pending_cap) {
+        int cap = super.free_pending_cap > 0 ? super.free_pending_cap * 2 : NFS_FREE_PENDING_INIT;
+        int *blks = (int *)realloc(super.free_pending, cap * sizeof(int));
+        if (blks == NULL) {
+            /* 宁可泄漏这个块，也不在事务提交前把它交还分配器 */
+            printf("[NEWFS] Warning: no memory to defer freeing block %d, leaked\n", block_no);
+            return;
+        }
+        super.free_pending = blks;
+        super.free_pending_cap = cap;
+    }
+    super.free_pending[super.free_pending_cnt++] = block_no;
+    NFS_MAP_DIRTY(grp->data_map_dirty_lo, grp->data_map_dirty_hi, blk_idx / 8);
+}
+
+/**
+ * @brief 释放一棵间接块树：level 为 0 时 blk 是数据块，否则是第 level 级间接块
+ */
+static void newfs_free_tree(uint32_t blk, int level) {
+    if (level > 0) {
+        for (int i = 0; i < (int)NFS_PTRS_PER_BLK(); i++) {
+            uint32_t ptr;
+            /* 读不出来的指针跳过：宁可泄漏子树，也不释放不确定的块号 */
+            if (newfs_bmap_get_ptr(blk, i, &ptr) == NFS_ERROR_NONE && ptr != 0) {
+                newfs_free_tree(ptr, level - 1);
+            }
+        }
+        newfs_cache_forget(blk);
+    }
+    newfs_free_data_block(blk);
+}
+
+/**
+ * @brief 释放 inode 中逻辑块 lblk 及之后的所有数据块（截断文件）
+ *
+ * 完全落在截断点之后的间接块树整棵释放；截断点所在的树只清除数据块指针，
+ * 其中的间接块保留，文件重新增长时直接复用。
+ * 调用者须先丢弃这些块的缓存页，并在之后修改 inode->size
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_unmap_blocks(struct newfs_inode *inode, int lblk) {
+    long long ptrs = NFS_PTRS_PER_BLK();
+    long long start = NFS_DATA_PER_FILE, span = ptrs;
+    long long end = ((long long)inode->size + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
+
+    for (int i = lblk; i < NFS_DATA_PER_FILE; i++) {
+        if (inode->block_pointer[i] != 0) {
+            uint32_t ptr = inode->block_pointer[i];
+            inode->block_pointer[i] = 0;
+            newfs_free_data_block(ptr);
+        }
+    }
+
+    for (int depth = 1; depth <= NFS_IND_LEVELS; depth++, start += span, span *= ptrs) {
+        if (inode->indirect[depth - 1] == 0 || lblk >= start + span) {
+            continue;
+        }
+        if (lblk <= start) {
+            uint32_t root = inode->indirect[depth - 1];
+            inode->indirect[depth - 1] = 0;
+            newfs_free_tree(root, depth);
+            continue;
+        }
+
+        /* 截断点落在这棵树中：逐个最末级间接块清除截断点之后的指针 */
+        bool emptied = false;
+        for (long long base = lblk - (lblk - start) % ptrs; base < end && base < start + span; base += ptrs) {
+            int leaf, idx;
+
+            leaf = newfs_bmap_leaf(inode, (int)base, false, -1, &idx);
+            if (leaf < 0) {
+                return leaf;
+            }
+            for (idx = base < lblk ? lblk - base : 0; leaf > 0 && idx < ptrs; idx++) {
+                uint32_t ptr;
+                if (newfs_bmap_get_ptr(leaf, idx, &ptr) != NFS_ERROR_NONE) {
+                    return -NFS_ERROR_IO;
+                }
+                if (ptr != 0) {
+                    /* 先清除指针再释放：清除失败时块仍被引用，不能交出去 */
+                    if (newfs_bmap_set_ptr(leaf, idx, 0) != NFS_ERROR_NONE) {
+                        return -NFS_ERROR_IO;
+                    }
+                    newfs_free_data_block(ptr);
+                }
+            }
+            if (leaf > 0 && base >= lblk) {
+                emptied = true;
+            }
+        }
+        /* 整块清空的间接块随即释放，不攒到整棵树释放时一起弄脏大量位图块 */
+        if (emptied && newfs_bmap_prune(inode->indirect[depth - 1], depth, start, lblk, end)) {
+            uint32_t root = inode->indirect[depth - 1];
+            inode->indirect[depth - 1] = 0;
+            newfs_cache_forget(root);
+            newfs_free_data_block(root);
+        }
+    }
+    inode->bmap_leaf = 0;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把 block_pointer 压缩成 extent 列表，逻辑与物理都连续的块合成一项
+ */
+static void newfs_extents_encode(const uint32_t *block_pointer, struct newfs_extent_d *extents)
+{
+    int cnt = 0;
+
+    memset(extents, 0, sizeof(struct newfs_extent_d) * NFS_DATA_PER_FILE);
+    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+    {
+        struct newfs_extent_d *last = cnt > 0 ? &extents[cnt - 1] : NULL;
+
+        if (block_pointer[i] == 0)
+        {
+            continue;
+        }
+        if (last && last->lblk + last->len == i && last->start + last->len == block_pointer[i])
+        {
+            last->len++;
+            continue;
+        }
+        extents[cnt].lblk = i;
+        extents[cnt].start = block_pointer[i];
+        extents[cnt].len = 1;
+        cnt++;
+    }
+}
+
+/**
+ * @brief 把 extent 列表展开成 block_pointer
+ */
+static void newfs_extents_decode(const struct newfs_extent_d *extents, uint32_t *block_pointer)
+{
+    memset(block_pointer, 0, sizeof(uint32_t) * NFS_DATA_PER_FILE);
+    for (int i = 0; i < NFS_DATA_PER_FILE && extents[i].len > 0; i++)
+    {
+        for (uint32_t j = 0; j < extents[i].len && extents[i].lblk + j < NFS_DATA_PER_FILE; j++)
+        {
+            block_pointer[extents[i].lblk + j] = extents[i].start + j;
+        }
+    }
+}
 
-	dentry->ino = ino;
-	dentry->inode = inode;
+/**
+ * @brief 按逻辑偏移读写 inode 的数据，逐块经过 newfs_bmap 映射，要求涉及的块都已分配
+ */
+static int newfs_inode_io(struct newfs_inode *inode, int offset, uint8_t *buf, int size, bool is_write)
+{
+    while (size > 0)
+    {
+        int lblk = offset / NFS_BLKS_SZ();
+        int bias = offset % NFS_BLKS_SZ();
+        int len = NFS_BLKS_SZ() - bias < size ? NFS_BLKS_SZ() - bias : size;
+        int block_no = newfs_bmap(inode, lblk);
+        int ret;
 
-	return inode;
+        if (block_no <= 0)
+        {
+            return block_no < 0 ? block_no : -NFS_ERROR_INVAL;
+        }
+        if (is_write)
+        {
+            ret = newfs_driver_write((off_t)block_no * NFS_BLKS_SZ() + bias, buf, len);
+        }
+        else
+        {
+            ret = newfs_driver_read((off_t)block_no * NFS_BLKS_SZ() + bias, buf, len);
+        }
+        if (ret != NFS_ERROR_NONE)
+        {
+            return ret;
+        }
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 分配一个 inode 编号
+ * @brief 把目录项打包成变长记录
+ *
+ * 新目录项插在链表头，按链表逆序打包即为创建顺序，已有的记录位置不变、新记录追加在后面。
+ * 从 stop 打包到链表头（stop 为 NULL 时打包全部目录项），stop 应位于块首。
+ * 记录不跨块：当前块放不下时，把上一条记录延伸到块尾，从下一块开始
+ *
+ * @param out 输出整块对齐的内容，由调用者释放
+ * @param tail 输出最后一块中的第一个目录项
+ * @return int 占用的块数，出错返回负的错误号
  */
-int newfs_alloc_ino()
+static int newfs_dir_pack(struct newfs_inode *inode, struct newfs_dentry *stop,
+                          uint8_t **out, struct newfs_dentry **tail)
 {
-	/* 在位图中查找空闲的 inode */
-	for (int byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(); byte_cursor++)
-	{
-		for (int bit_cursor = 0; bit_cursor < 8; bit_cursor++)
-		{
-			int ino = byte_cursor * 8 + bit_cursor;
-			if (ino >= super.max_ino)
-			{
-				return -1; // 没有空闲 inode
-			}
+    struct newfs_dentry_d *last = NULL;
+    struct newfs_dentry *dentry_cursor;
+    struct newfs_dentry **dentrys;
+    uint8_t *buf;
+    int cnt = 0, ofs = 0, max_blks;
 
-			/* 检查该位是否为 0（空闲） */
-			if ((super.map_inode[byte_cursor] & (1 << bit_cursor)) == 0)
-			{
-				/* 标记为已使用 */
-				super.map_inode[byte_cursor] |= (1 << bit_cursor);
-				return ino;
-			}
-		}
-	}
-	return -1;
+    for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother)
+    {
+        cnt++;
+        if (dentry_cursor == stop)
+        {
+            break;
+        }
+    }
+    max_blks = (cnt + NFS_DENTRYS_PER_BLK() - 1) / NFS_DENTRYS_PER_BLK();
+    buf = (uint8_t *)calloc(max_blks > 0 ? max_blks : 1, NFS_BLKS_SZ());
+    dentrys = (struct newfs_dentry **)malloc((cnt > 0 ? cnt : 1) * sizeof(struct newfs_dentry *));
+    if (buf == NULL || dentrys == NULL)
+    {
+        free(buf);
+        free(dentrys);
+        return -NFS_ERROR_NOSPACE;
+    }
+    dentry_cursor = inode->dentrys;
+    for (int i = cnt - 1; i >= 0; i--)
+    {
+        dentrys[i] = dentry_cursor;
+        dentry_cursor = dentry_cursor->brother;
+    }
+
+    *tail = NULL;
+    for (int i = 0; i < cnt; i++)
+    {
+        int name_len = strlen(dentrys[i]->name);
+        int rec_len = NFS_DENTRY_REC_LEN(name_len);
+        struct newfs_dentry_d *rec;
+
+        if (ofs % NFS_BLKS_SZ() + rec_len > NFS_BLKS_SZ())
+        {
+            last->rec_len += NFS_BLKS_SZ() - ofs % NFS_BLKS_SZ();
+            ofs = NFS_ROUND_UP(ofs, NFS_BLKS_SZ());
+        }
+        if (ofs % NFS_BLKS_SZ() == 0)
+        {
+            *tail = dentrys[i];
+        }
+        rec = (struct newfs_dentry_d *)(buf + ofs);
+        rec->ino = dentrys[i]->ino;
+        rec->rec_len = rec_len;
+        rec->name_len = name_len;
+        rec->ftype = dentrys[i]->ftype;
+        memcpy(rec->fname, dentrys[i]->name, name_len);
+        last = rec;
+        ofs += rec_len;
+    }
+    if (last != NULL && ofs % NFS_BLKS_SZ() != 0)
+    {
+        last->rec_len += NFS_BLKS_SZ() - ofs % NFS_BLKS_SZ();
+    }
+    free(dentrys);
+
+    *out = buf;
+    return (ofs + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
 }
 
 /**
- * @brief 分配一个数据块
+ * @brief 解析一个目录块中的变长记录，挂到目录 inode 下
+ *
+ * @param first 输出块中的第一个目录项，空块为 NULL
+ * @return int 0成功，记录长度越界时返回 -NFS_ERROR_INVAL
  */
-int newfs_alloc_data_block() {
-    /* 在位图中查找空闲的数据块 */
-    for (int byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(); byte_cursor++) {
-        for (int bit_cursor = 0; bit_cursor < 8; bit_cursor++) {
-            int blk_idx = byte_cursor * 8 + bit_cursor;
-            if (blk_idx >= super.data_blks) {
-                return -1;  // 没有空闲数据块
-            }
+static int newfs_dir_parse_blk(struct newfs_inode *inode, const uint8_t *data,
+                               struct newfs_dentry **first)
+{
+    char name[MAX_NAME_LEN];
+    int bias = 0;
+
+    *first = NULL;
+    while (bias + (int)sizeof(struct newfs_dentry_d) <= NFS_BLKS_SZ())
+    {
+        const struct newfs_dentry_d *rec = (const struct newfs_dentry_d *)(data + bias);
+        struct newfs_dentry *sub_dentry;
+
+        /* rec_len 是 32 位无符号数，与块内剩余长度比较，避免相加回绕 */
+        if (rec->rec_len < sizeof(struct newfs_dentry_d) || rec->rec_len > (uint32_t)(NFS_BLKS_SZ() - bias)
+            || NFS_DENTRY_REC_LEN(rec->name_len) > rec->rec_len)
+        {
+            return -NFS_ERROR_INVAL;
+        }
+        if (rec->name_len > 0)
+        {
+            int name_len = rec->name_len < MAX_NAME_LEN ? rec->name_len : MAX_NAME_LEN - 1;
 
-            /* 检查该位是否为 0（空闲） */
-            if ((super.map_data[byte_cursor] & (1 << bit_cursor)) == 0) {
-                /* 标记为已使用 */
-                super.map_data[byte_cursor] |= (1 << bit_cursor);
-                return super.data_offset + blk_idx;  // 返回实际块号
+            memcpy(name, rec->fname, name_len);
+            name[name_len] = '\0';
+            sub_dentry = newfs_alloc_dentry(name, (NFS_FILE_TYPE)rec->ftype);
+            if (sub_dentry == NULL)
+            {
+                return -NFS_ERROR_NOSPACE;
+            }
+            sub_dentry->parent = inode->dentry;
+            sub_dentry->ino = rec->ino;
+            newfs_alloc_dentry_to_inode(inode, sub_dentry);
+            if (*first == NULL)
+            {
+                *first = sub_dentry;
             }
         }
+        bias += rec->rec_len;
     }
-    return -1;
+    return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 释放一个数据块
+ * @brief 释放目录打包后用不到的块
+ *
+ * 移除过目录项后整体重新打包，占用的块可能变少。
+ * 释放前先丢弃这些块的缓存内容，它们之后可能被分配为其他用途
+ *
+ * @param dir_blks 打包后占用的块数
+ * @return int 0成功，否则返回对应错误号
  */
-void newfs_free_data_block(int block_no) {
-    if (block_no < super.data_offset || block_no >= super.data_offset + super.data_blks) {
-        return;  // 无效的块号
+static int newfs_dir_trim(struct newfs_inode *inode, int dir_blks)
+{
+    int old_blks = (inode->size + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
+
+    if (old_blks <= dir_blks)
+    {
+        return NFS_ERROR_NONE;
     }
-    
-    int blk_idx = block_no - super.data_offset;
-    int byte_idx = blk_idx / 8;
-    int bit_idx = blk_idx % 8;
-    
-    /* 清除位图中的对应位 */
-    super.map_data[byte_idx] &= ~(1 << bit_idx);
+    for (int i = dir_blks; i < old_blks; i++)
+    {
+        int block_no = newfs_bmap(inode, i);
+
+        if (block_no < 0)
+        {
+            return block_no;
+        }
+        if (block_no > 0)
+        {
+            newfs_cache_forget(block_no);
+        }
+    }
+    return newfs_unmap_blocks(inode, dir_blks);
 }
 
 /**
- * @brief 将内存 inode 及其下方结构全部刷回磁盘
+ * @brief 将一个内存 inode 写入块缓存，目录连同新增的目录项一起写入
+ *
+ * 只处理 inode 本身，不再递归子目录；子 inode 是否需要写入由脏 inode 链表决定。
+ * 目录只从最后一块起重新打包，新目录项追加在后面，前面的目录块保持不变；
+ * 移除过目录项（dir_tail 为 NULL）时才整体重新打包
  */
 int newfs_sync_inode(struct newfs_inode *inode)
 {
     struct newfs_inode_d inode_d;
-    struct newfs_dentry *dentry_cursor;
-    struct newfs_dentry_d dentry_d;
+    struct newfs_dentry *tail = NULL;
+    uint8_t *dir_buf = NULL;
     int ino = inode->ino;
-    int offset;
+    int first_blk = 0, dir_blks = 0;
 
-    /* 先处理目录的数据块分配（在写入 inode 之前） */
-    if (NFS_IS_DIR(inode))
+    /* 先把目录项打包并分配数据块（在写入 inode 之前），目录大小记为占用的块 */
+    if (NFS_IS_DIR(inode) && (inode->dir_tail ? inode->dentrys != inode->dir_synced
+                                              : inode->dir_cnt > 0 || inode->size > 0))
     {
-        /* 如果是目录，数据是目录项 */
-        /* 为目录分配第一个数据块（如果还没分配） */
-        if (inode->dir_cnt > 0 && inode->block_pointer[0] == 0)
+        first_blk = inode->dir_tail ? inode->dir_tail_blk : 0;
+        dir_blks = newfs_dir_pack(inode, inode->dir_tail, &dir_buf, &tail);
+        if (dir_blks < 0)
         {
-            int block_no = newfs_alloc_data_block();
-            if (block_no == -1)
-            {
-                return -NFS_ERROR_NOSPACE;
-            }
-            inode->block_pointer[0] = block_no;
+            return dir_blks;
+        }
+        if (newfs_map_blocks(inode, first_blk, dir_blks) != NFS_ERROR_NONE)
+        {
+            free(dir_buf);
+            return -NFS_ERROR_NOSPACE;
+        }
+        if (inode->dir_tail == NULL && newfs_dir_trim(inode, dir_blks) != NFS_ERROR_NONE)
+        {
+            free(dir_buf);
+            return -NFS_ERROR_IO;
         }
+        inode->size = (first_blk + dir_blks) * NFS_BLKS_SZ();
     }
 
     /* 填充磁盘 inode 结构 */
+    memset(&inode_d, 0, sizeof(struct newfs_inode_d));
     inode_d.ino = ino;
     inode_d.size = inode->size;
     inode_d.dir_cnt = inode->dir_cnt;
     inode_d.ftype = inode->ftype;
-    memcpy(inode_d.target_path, inode->target_path, MAX_NAME_LEN);
-
-    /* 复制数据块指针（此时 block_pointer 已经分配好了） */
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+    if (inode->is_inline)
     {
-        inode_d.block_pointer[i] = inode->block_pointer[i];
+        memcpy(inode_d.inline_data, inode->inline_data, NFS_INLINE_MAX);
     }
 
+    /* 数据块映射以 extent 形式落盘（此时 block_pointer 已经分配好了） */
+    newfs_extents_encode(inode->block_pointer, inode_d.extents);
+    memcpy(inode_d.indirect, inode->indirect, sizeof(inode_d.indirect));
+
     /* 写 inode 到磁盘 */
     if (newfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
                            sizeof(struct newfs_inode_d)) != NFS_ERROR_NONE)
     {
+        free(dir_buf);
         return -NFS_ERROR_IO;
     }
 
-    /* 写 inode 下方的数据 */
-    if (NFS_IS_DIR(inode))
+    /* 目录块整块写入，块缓存不需要预读 */
+    if (dir_buf != NULL)
     {
-        /* 写入目录项到数据块 */
-        if (inode->block_pointer[0] != 0)
-        {
-            dentry_cursor = inode->dentrys;
-            offset = inode->block_pointer[0] * NFS_BLKS_SZ();
+        int ret = newfs_inode_io(inode, first_blk * NFS_BLKS_SZ(), dir_buf, dir_blks * NFS_BLKS_SZ(), true);
 
-            while (dentry_cursor != NULL)
-            {
-                memcpy(dentry_d.fname, dentry_cursor->name, MAX_NAME_LEN);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
+        free(dir_buf);
+        if (ret != NFS_ERROR_NONE)
+        {
+            return -NFS_ERROR_IO;
+        }
+        inode->dir_tail = tail;
+        inode->dir_tail_blk = first_blk + dir_blks - 1;
+        inode->dir_synced = inode->dentrys;
+        inode->dir_synced_cnt = inode->dir_cnt;
+        newfs_pcache_resv(inode, 0);              /* 新目录项的块已经分配 */
+    }
 
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d,
-                                       sizeof(struct newfs_dentry_d)) != NFS_ERROR_NONE)
-                {
-                    return -NFS_ERROR_IO;
-                }
+    return NFS_ERROR_NONE;
+}
 
-                /* 递归写入子 inode */
-                if (dentry_cursor->inode != NULL)
-                {
-                    newfs_sync_inode(dentry_cursor->inode);
-                }
+/**
+ * @brief 读取目录出错时释放已经建立的目录项和哈希表，子目录项还没有读入 inode
+ *
+ * @return struct newfs_inode* 总是 NULL
+ */
+static struct newfs_inode *newfs_read_inode_fail(struct newfs_inode *inode)
+{
+    struct newfs_dentry *dentry_cursor = inode->dentrys;
 
-                dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct newfs_dentry_d);
-            }
-        }
-    }
-    else if (NFS_IS_REG(inode))
+    while (dentry_cursor != NULL)
     {
-        /* 如果是文件，数据块已经在 write 操作时分配和写入 */
-        /* 这里只需要确保 block_pointer 已经记录在 inode_d 中 */
-    }
+        struct newfs_dentry *next = dentry_cursor->brother;
 
-    return NFS_ERROR_NONE;
+        free(dentry_cursor);
+        dentry_cursor = next;
+    }
+    free(inode->dhash);
+    free(inode);
+    return NULL;
 }
 
 /**
  * @brief 从磁盘读取 inode
+ *
+ * @return struct newfs_inode* 读取失败或目录块损坏时返回 NULL
  */
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
 {
     struct newfs_inode *inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
-    struct newfs_inode_d inode_d;
-    struct newfs_dentry *sub_dentry;
-    struct newfs_dentry_d dentry_d;
+    struct newfs_inode_d inode_copy;
+    const struct newfs_inode_d *inode_d;
+    off_t ino_ofs = NFS_INO_OFS(ino);
+    int ino_blk = ino_ofs / NFS_BLKS_SZ();
+    uint8_t *data = NULL;
     int dir_cnt = 0, i;
 
     if (inode == NULL)
@@ -944,51 +2489,118 @@ struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
         return NULL;
     }
 
-    /* 从磁盘读索引节点 */
-    if (newfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d,
-                          sizeof(struct newfs_inode_d)) != NFS_ERROR_NONE)
+    /* 从磁盘读索引节点：整个落在一个块内时钉住缓存块就地解析，跨块时才拷贝拼接 */
+    if (ino_ofs % NFS_BLKS_SZ() + sizeof(struct newfs_inode_d) <= (size_t)NFS_BLKS_SZ())
+    {
+        data = newfs_cache_pin(ino_blk, false);
+    }
+    if (data != NULL)
+    {
+        inode_d = (const struct newfs_inode_d *)(data + ino_ofs % NFS_BLKS_SZ());
+    }
+    else if (newfs_driver_read(ino_ofs, (uint8_t *)&inode_copy,
+                               sizeof(struct newfs_inode_d)) == NFS_ERROR_NONE)
+    {
+        inode_d = &inode_copy;
+    }
+    else
     {
         free(inode);
         return NULL;
     }
 
     /* 填充内存 inode 结构 */
-    inode->ino = inode_d.ino;
-    inode->size = inode_d.size;
+    inode->ino = inode_d->ino;
+    inode->size = inode_d->size;
     inode->dir_cnt = 0;
-    inode->ftype = inode_d.ftype;
-    memcpy(inode->target_path, inode_d.target_path, MAX_NAME_LEN);
+    inode->ftype = inode_d->ftype;
+    memcpy(inode->inline_data, inode_d->inline_data, NFS_INLINE_MAX);
     inode->dentry = dentry;
     inode->dentrys = NULL;
-    inode->data = NULL;  /* 初始化数据缓存指针 */
-
-    /* 复制数据块指针 */
-    for (int i = 0; i < NFS_DATA_PER_FILE; i++)
+    inode->pages = NULL;  /* 还没有缓存页 */
+    inode->pages_sz = 0;
+    inode->page_cnt = 0;
+    inode->delalloc_cnt = 0;
+    inode->resv_blks = 0;
+
+    /* 展开数据块映射 */
+    newfs_extents_decode(inode_d->extents, inode->block_pointer);
+    memcpy(inode->indirect, inode_d->indirect, sizeof(inode->indirect));
+    inode->bmap_leaf = 0;
+
+    /* 内联与否不单独记录：不超过 NFS_INLINE_MAX 字节、也没有任何数据块的文件是内联的。
+     * 转为使用数据块的文件在写回时至少分配了逻辑块 0（截断到 0 时又回到内联），
+     * 只在块 0 是空洞的小文件按内联读取，内容同样全为 0 */
+    inode->is_inline = !NFS_IS_DIR(inode) && inode->size <= NFS_INLINE_MAX
+                       && inode->block_pointer[0] == 0 && inode->indirect[0] == 0;
+    if (!inode->is_inline)
+    {
+        memset(inode->inline_data, 0, NFS_INLINE_MAX);
+    }
+    dir_cnt = inode_d->dir_cnt;
+    if (data != NULL)
     {
-        inode->block_pointer[i] = inode_d.block_pointer[i];
+        newfs_cache_unpin(ino_blk);
     }
 
+    inode->is_dirty = false;
+    inode->dirty_next = NULL;
+    inode->dhash = NULL;
+    inode->dhash_sz = 0;
+    inode->dir_gen = 0;
+    inode->dir_tail = NULL;
+    inode->dir_tail_blk = 0;
+    inode->dir_synced = NULL;
+    inode->dir_synced_cnt = 0;
+
     /* 读取 inode 的数据或子目录项 */
     if (NFS_IS_DIR(inode))
     {
-        dir_cnt = inode_d.dir_cnt;
-        /* 从第一个数据块读取目录项 */
+        /* 大目录按磁盘上的目录项数一次建好哈希表，插入时不再扩容 */
+        if (dir_cnt > NFS_DHASH_MIN)
+        {
+            newfs_dhash_resize(inode, dir_cnt);
+        }
+        /* 目录项所在的块分批一次提交读取，再逐块钉住、就地解析目录项 */
         if (dir_cnt > 0 && inode->block_pointer[0] != 0)
         {
-            for (i = 0; i < dir_cnt; i++)
+            int dir_blks = inode->size / NFS_BLKS_SZ();
+            int blks[NFS_PREFETCH_BATCH], nr = 0;
+
+            for (i = 0; i < dir_blks; i++)
             {
-                if (newfs_driver_read(inode->block_pointer[0] * NFS_BLKS_SZ() + i * sizeof(struct newfs_dentry_d),
-                                      (uint8_t *)&dentry_d,
-                                      sizeof(struct newfs_dentry_d)) != NFS_ERROR_NONE)
+                if ((blks[nr] = newfs_bmap(inode, i)) > 0)
+                {
+                    nr++;
+                }
+                if (nr == NFS_PREFETCH_BATCH || i == dir_blks - 1)
                 {
-                    return NULL;
+                    newfs_cache_prefetch(blks, nr);
+                    nr = 0;
                 }
+            }
 
-                sub_dentry = newfs_alloc_dentry(dentry_d.fname, dentry_d.ftype);
-                sub_dentry->parent = inode->dentry;
-                sub_dentry->ino = dentry_d.ino;
-                newfs_alloc_dentry_to_inode(inode, sub_dentry);
+            for (i = 0; i < dir_blks; i++)
+            {
+                int block_no = newfs_bmap(inode, i);
+                int ret;
+
+                data = block_no > 0 ? newfs_cache_pin(block_no, false) : NULL;
+                if (data == NULL)
+                {
+                    return newfs_read_inode_fail(inode);
+                }
+                ret = newfs_dir_parse_blk(inode, data, &inode->dir_tail);
+                newfs_cache_unpin(block_no);
+                if (ret != NFS_ERROR_NONE)
+                {
+                    return newfs_read_inode_fail(inode);
+                }
             }
+            /* 之后的新目录项从最后一块接着打包 */
+            inode->dir_tail_blk = dir_blks - 1;
+            inode->dir_synced = inode->dentrys;
+            inode->dir_synced_cnt = inode->dir_cnt;
         }
     }
     else if (NFS_IS_REG(inode))
@@ -1001,7 +2613,94 @@ struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
 }
 
 /**
- * @brief 将 dentry 插入到 inode 中（头插法）
+ * @brief 目录项名字的哈希值（FNV-1a）
+ */
+static uint32_t newfs_dhash_name(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void newfs_dhash_insert(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    uint32_t slot = newfs_dhash_name(dentry->name) & (inode->dhash_sz - 1);
+
+    dentry->hash_next = inode->dhash[slot];
+    inode->dhash[slot] = dentry;
+}
+
+/**
+ * @brief 将目录的哈希表调整到至少能容纳 cnt 个目录项（负载因子 <= 1）并重新散列
+ */
+static int newfs_dhash_resize(struct newfs_inode *inode, int cnt)
+{
+    struct newfs_dentry **dhash;
+    struct newfs_dentry *dentry_cursor;
+    uint32_t sz = 16;
+
+    while (sz < (uint32_t)cnt)
+    {
+        sz <<= 1;
+    }
+    if (sz <= inode->dhash_sz)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    dhash = (struct newfs_dentry **)calloc(sz, sizeof(struct newfs_dentry *));
+    if (dhash == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    free(inode->dhash);
+    inode->dhash = dhash;
+    inode->dhash_sz = sz;
+
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother)
+    {
+        newfs_dhash_insert(inode, dentry_cursor);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为目录中尚未写入的目录项再加 extra 项预留数据块及其间接块
+ *
+ * 增量打包时新目录项从最后一块接着写，最坏情况下每 NFS_DENTRYS_PER_BLK() 项占一个新块；
+ * 整体重新打包时按全部目录项计算，已有的块可以复用。
+ * 预留在刷写该目录时释放，保证写回目录时不会因为空间不足而失败
+ *
+ * @return int 0成功，空闲块不够时返回 -NFS_ERROR_NOSPACE
+ */
+static int newfs_dir_reserve(struct newfs_inode *inode, int extra)
+{
+    int blks = inode->size / NFS_BLKS_SZ();
+    int need;
+
+    if (inode->dir_tail != NULL)
+    {
+        need = (inode->dir_cnt - inode->dir_synced_cnt + extra + NFS_DENTRYS_PER_BLK() - 1)
+               / NFS_DENTRYS_PER_BLK();
+    }
+    else
+    {
+        need = (inode->dir_cnt + extra + NFS_DENTRYS_PER_BLK() - 1) / NFS_DENTRYS_PER_BLK() - blks;
+    }
+    if (need <= 0)
+    {
+        return newfs_pcache_resv(inode, 0);
+    }
+    return newfs_pcache_resv(inode, need + newfs_bmap_meta_blks(inode, blks, blks + need - 1, need));
+}
+
+/**
+ * @brief 将 dentry 插入到 inode 中（头插法），同时维护目录哈希表
  */
 int newfs_alloc_dentry_to_inode(struct newfs_inode *inode, struct newfs_dentry *dentry)
 {
@@ -1015,16 +2714,32 @@ int newfs_alloc_dentry_to_inode(struct newfs_inode *inode, struct newfs_dentry *
         inode->dentrys = dentry;
     }
     inode->dir_cnt++;
+
+    if (inode->dhash && inode->dir_cnt <= inode->dhash_sz)
+    {
+        newfs_dhash_insert(inode, dentry);
+    }
+    else if (inode->dir_cnt > NFS_DHASH_MIN)
+    {
+        /* 首次超过阈值或负载过高：扩容并重新散列（包括本 dentry） */
+        if (newfs_dhash_resize(inode, inode->dir_cnt * 2) != NFS_ERROR_NONE)
+        {
+            free(inode->dhash);                   /* 退化为线性查找 */
+            inode->dhash = NULL;
+            inode->dhash_sz = 0;
+        }
+    }
     return inode->dir_cnt;
 }
 
 /**
- * @brief 将 dentry 从 inode 的 dentrys 中取出
+ * @brief 将 dentry 从 inode 的 dentrys 及哈希表中取出
  */
 int newfs_drop_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
 {
     bool is_find = false;
     struct newfs_dentry *dentry_cursor;
+    struct newfs_dentry **link;
 
     dentry_cursor = inode->dentrys;
 
@@ -1052,10 +2767,64 @@ int newfs_drop_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
         return -NFS_ERROR_NOTFOUND;
     }
 
+    if (inode->dhash)
+    {
+        link = &inode->dhash[newfs_dhash_name(dentry->name) & (inode->dhash_sz - 1)];
+        while (*link)
+        {
+            if (*link == dentry)
+            {
+                *link = dentry->hash_next;
+                break;
+            }
+            link = &(*link)->hash_next;
+        }
+    }
+    dentry->brother = NULL;
+    dentry->hash_next = NULL;
+    newfs_dcache_flush();                         /* 路径缓存中可能还有指向它的项 */
+    inode->dir_gen++;                             /* readdir 游标可能正指向它 */
+    inode->dir_tail = NULL;                       /* 后面的记录要前移，下次整体重新打包 */
+    inode->dir_synced = NULL;
+
     inode->dir_cnt--;
     return inode->dir_cnt;
 }
 
+/**
+ * @brief 在目录中按名字查找子目录项，大目录走哈希表，小目录线性查找
+ * @param inode 目录的 inode
+ * @param name 子目录项名字
+ * @return struct newfs_dentry* 找到的 dentry，不存在返回 NULL
+ */
+struct newfs_dentry *newfs_find_dentry(struct newfs_inode *inode, const char *name)
+{
+    struct newfs_dentry *dentry_cursor;
+
+    if (inode->dhash)
+    {
+        dentry_cursor = inode->dhash[newfs_dhash_name(name) & (inode->dhash_sz - 1)];
+        while (dentry_cursor)
+        {
+            if (strcmp(name, dentry_cursor->name) == 0)
+            {
+                return dentry_cursor;
+            }
+            dentry_cursor = dentry_cursor->hash_next;
+        }
+        return NULL;
+    }
+
+    for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother)
+    {
+        if (strcmp(name, dentry_cursor->name) == 0)
+        {
+            return dentry_cursor;
+        }
+    }
+    return NULL;
+}
+
 /**
  * @brief 根据偏移获取目录的第 dir_index 个子目录项
  * @param inode 目录的 inode
@@ -1121,10 +2890,13 @@ int newfs_calc_lvl(const char *path)
 
 /**
  * @brief 路径查找
+ *
+ * 先查路径缓存，命中时不分词也不分配内存；未命中时逐级查找并记录结果
+ *
  * @param path 路径
  * @param is_find 是否找到
  * @param is_root 是否是根目录
- * @return 找到的 dentry 或最后一个有效的 dentry
+ * @return 找到的 dentry 或最后一个有效的 dentry；途中的 inode 读取失败时返回 NULL
  */
 struct newfs_dentry *newfs_lookup(const char *path, bool *is_find, bool *is_root)
 {
@@ -1135,21 +2907,27 @@ struct newfs_dentry *newfs_lookup(const char *path, bool *is_find, bool *is_root
     int lvl = 0;
     bool is_hit;
     char *fname = NULL;
-    char *path_cpy = (char *)malloc(strlen(path) + 1);
+    char *path_cpy;
 
     *is_root = false;
     *is_find = false;
-    strcpy(path_cpy, path);
 
     if (total_lvl == 0)
     {
         *is_find = true;
         *is_root = true;
-        dentry_ret = super.root_dentry;
-        free(path_cpy);
+        return super.root_dentry;
+    }
+
+    dentry_ret = newfs_dcache_lookup(path, is_find);
+    if (dentry_ret)
+    {
         return dentry_ret;
     }
 
+    path_cpy = (char *)malloc(strlen(path) + 1);
+    strcpy(path_cpy, path);
+
     fname = strtok(path_cpy, "/");
     while (fname)
     {
@@ -1161,6 +2939,11 @@ struct newfs_dentry *newfs_lookup(const char *path, bool *is_find, bool *is_root
         }
 
         inode = dentry_cursor->inode;
+        if (inode == NULL)
+        {
+            dentry_ret = NULL;                    /* 读不出来的目录按路径不存在处理 */
+            break;
+        }
 
         if (NFS_IS_REG(inode) && lvl < total_lvl)
         {
@@ -1170,18 +2953,8 @@ struct newfs_dentry *newfs_lookup(const char *path, bool *is_find, bool *is_root
 
         if (NFS_IS_DIR(inode))
         {
-            dentry_cursor = inode->dentrys;
-            is_hit = false;
-
-            while (dentry_cursor)
-            {
-                if (strcmp(fname, dentry_cursor->name) == 0)
-                {
-                    is_hit = true;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+            dentry_cursor = newfs_find_dentry(inode, fname);
+            is_hit = dentry_cursor != NULL;
 
             if (!is_hit)
             {
@@ -1205,6 +2978,12 @@ struct newfs_dentry *newfs_lookup(const char *path, bool *is_find, bool *is_root
     {
         dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
     }
+    if (dentry_ret && dentry_ret->inode == NULL)
+    {
+        *is_find = false;
+        dentry_ret = NULL;
+    }
+    newfs_dcache_insert(path, dentry_ret, *is_find);
 
     free(path_cpy);
     return dentry_ret;
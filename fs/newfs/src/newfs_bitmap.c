@@ -0,0 +1,159 @@
+#include "newfs.h"
+
+/******************************************************************************
+* SECTION: 位图分配
+*
+* inode 位图与数据块位图共用的分配器，第 i 位位于第 i / 8 字节的第 i % 8 位：
+*   - 按 64 位字扫描，字不全为 1 时用 ctz 直接得到空闲位
+*   - 从 hint 指定的位开始扫描（next-fit 或调用者给出的目标位置），
+*     到末尾后回绕，顺序分配时几乎只看一个字
+*   - newfs_bitmap_alloc_run 在找到的空闲位之后继续占用相邻空闲位，
+*     一次分配出物理连续的一段
+*   - 空闲计数由调用者维护，挂载时用 popcount 统计一次
+*******************************************************************************/
+#define NFS_BITMAP_WORD_BITS    64
+
+/**
+ * @brief 读取第 i 个 64 位字（小端，与按字节存放的位序一致）
+ */
+static inline uint64_t newfs_bitmap_word(const uint8_t *map, int i)
+{
+    uint64_t word;
+
+    memcpy(&word, map + (size_t)i * sizeof(uint64_t), sizeof(uint64_t));
+    return word;
+}
+
+/**
+ * @brief 在 [from, to) 字范围内查找第一个不全为 1 的字
+ *
+ * @return int 字序号，找不到返回 -1
+ */
+static int newfs_bitmap_scan(const uint8_t *map, int from, int to)
+{
+    for (int i = from; i < to; i++)
+    {
+        if (~newfs_bitmap_word(map, i) != 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 分配一位
+ *
+ * @param map 位图
+ * @param nbits 有效位数，map 至少有 nbits 向上取整到 64 位的空间
+ * @param hint 从该位开始查找，分配成功后更新为分配到的位
+ * @return int 分配到的位序号，位图已满返回 -1
+ */
+int newfs_bitmap_alloc(uint8_t *map, int nbits, int *hint)
+{
+    int nwords = (nbits + NFS_BITMAP_WORD_BITS - 1) / NFS_BITMAP_WORD_BITS;
+    int goal = (*hint >= 0 && *hint < nbits) ? *hint : 0;
+    int start = goal / NFS_BITMAP_WORD_BITS;
+    int i = start + 1;
+    uint64_t word;
+
+    /* hint 所在字中只看 hint 及之后的位 */
+    word = newfs_bitmap_word(map, start) | ((1ULL << (goal % NFS_BITMAP_WORD_BITS)) - 1);
+    if (~word != 0)
+    {
+        int bit = start * NFS_BITMAP_WORD_BITS + __builtin_ctzll(~word);
+        if (bit < nbits)
+        {
+            map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+            *hint = bit;
+            return bit;
+        }
+    }
+
+    /* 从下一个字扫描到末尾，再回绕扫描到 hint 所在字（含） */
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int to = pass == 0 ? nwords : start + 1;
+
+        while ((i = newfs_bitmap_scan(map, i, to)) >= 0)
+        {
+            int bit = i * NFS_BITMAP_WORD_BITS + __builtin_ctzll(~newfs_bitmap_word(map, i));
+
+            /* 最后一个字中超出 nbits 的位总是 0，不能当作空闲位 */
+            if (bit < nbits)
+            {
+                map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+                *hint = bit;
+                return bit;
+            }
+            i++;
+        }
+        i = 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 分配一段尽量连续的位
+ *
+ * 先像 newfs_bitmap_alloc 一样找到 hint 之后的第一个空闲位，
+ * 再向后占用相邻的空闲位，直到凑够 want 位或遇到已分配位
+ *
+ * @param hint 从该位开始查找，分配成功后更新为这一段的最后一位
+ * @param want 希望分配的位数
+ * @param got 实际分配的位数，1 <= got <= want
+ * @return int 这一段的第一位，位图已满返回 -1
+ */
+int newfs_bitmap_alloc_run(uint8_t *map, int nbits, int *hint, int want, int *got)
+{
+    int bit = newfs_bitmap_alloc(map, nbits, hint);
+    int cnt = 1;
+
+    if (bit == -1)
+    {
+        return -1;
+    }
+
+    while (cnt < want && bit + cnt < nbits &&
+           (map[(bit + cnt) / 8] & (1 << ((bit + cnt) % 8))) == 0)
+    {
+        map[(bit + cnt) / 8] |= (uint8_t)(1 << ((bit + cnt) % 8));
+        cnt++;
+    }
+    *hint = bit + cnt - 1;
+    *got = cnt;
+    return bit;
+}
+
+/**
+ * @brief 释放一位
+ *
+ * @return bool 该位原先是否已分配
+ */
+bool newfs_bitmap_free(uint8_t *map, int bit)
+{
+    uint8_t mask = (uint8_t)(1 << (bit % 8));
+    bool was_set = (map[bit / 8] & mask) != 0;
+
+    map[bit / 8] &= ~mask;
+    return was_set;
+}
+
+/**
+ * @brief 统计前 nbits 位中已分配的位数
+ */
+int newfs_bitmap_count(const uint8_t *map, int nbits)
+{
+    int cnt = 0;
+    int i;
+
+    for (i = 0; (i + 1) * NFS_BITMAP_WORD_BITS <= nbits; i++)
+    {
+        cnt += __builtin_popcountll(newfs_bitmap_word(map, i));
+    }
+    for (int bit = i * NFS_BITMAP_WORD_BITS; bit < nbits; bit++)
+    {
+        cnt += (map[bit / 8] >> (bit % 8)) & 1;
+    }
+    return cnt;
+}
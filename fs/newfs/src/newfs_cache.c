@@ -0,0 +1,828 @@
+#include "newfs.h"
+
+/******************************************************************************
+* SECTION: 块缓存
+*
+* 位于 newfs_read_block / newfs_write_block 之下的写回式缓存：
+*   - 按块号哈希索引，命中时直接在内存中读写
+*   - 以扇区为单位记录有效位，整扇区覆盖写不需要预读，
+*     只有部分覆盖的首尾扇区才会从磁盘读入
+*   - 缓存满时使用 CLOCK 算法置换干净块，脏块只随日志事务写回
+*   - newfs_cache_sync 将所有脏块按块号排序后批量写回，
+*     块号连续的脏块合并成一次向量写，所有写请求一次性异步提交
+*   - newfs_cache_prefetch 一次提交一组块的读请求，重叠完成
+*   - 驱动支持 ddriver_map_block（mmap 模式）时，读入的块直接指向设备映像，
+*     不分配也不拷贝；第一次写入前才拷贝到缓存自己的内存（写时复制），
+*     保证脏数据仍按日志顺序落盘
+*   - newfs_cache_pin 钉住整块供调用者就地解析，钉住期间不会被置换
+*******************************************************************************/
+extern struct newfs_super super;
+
+#define NFS_CACHE_HASH(cache, blk)  ((unsigned)(blk) % (unsigned)(cache)->hash_sz)
+#define NFS_CACHE_MAX_IOV           64      /* 单次合并写回的最大块数 */
+#define NFS_CACHE_SLOT(cache, buf)  ((cache)->pool + (size_t)((buf) - (cache)->bufs) * NFS_BLKS_SZ())
+
+static void newfs_cache_unmap(struct newfs_buf *buf, bool copy);
+
+/**
+ * @brief 初始化块缓存
+ *
+ * @param capacity 缓存块数，<= 0 时使用默认值
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_cache_init(int capacity)
+{
+    struct newfs_cache *cache = &super.cache;
+
+    if (capacity <= 0)
+    {
+        capacity = NFS_CACHE_DEFAULT_BLKS;
+    }
+
+    memset(cache, 0, sizeof(struct newfs_cache));
+    cache->capacity = capacity;
+    cache->hash_sz = capacity * 2 + 1;
+    cache->bufs = (struct newfs_buf *)calloc(capacity, sizeof(struct newfs_buf));
+    cache->hash = (struct newfs_buf **)calloc(cache->hash_sz, sizeof(struct newfs_buf *));
+    cache->pool = (uint8_t *)malloc((size_t)capacity * NFS_BLKS_SZ());
+    if (cache->bufs == NULL || cache->hash == NULL || cache->pool == NULL)
+    {
+        newfs_cache_destroy();
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    for (int i = 0; i < capacity; i++)
+    {
+        cache->bufs[i].block_no = -1;
+        cache->bufs[i].data = cache->pool + (size_t)i * NFS_BLKS_SZ();
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放块缓存（不写回，调用前应先 newfs_cache_sync）
+ */
+void newfs_cache_destroy()
+{
+    struct newfs_cache *cache = &super.cache;
+
+    for (int i = 0; cache->bufs && i < cache->capacity; i++)
+    {
+        newfs_cache_unmap(&cache->bufs[i], false);
+    }
+    free(cache->bufs);
+    free(cache->hash);
+    free(cache->pool);
+    cache->bufs = NULL;
+    cache->hash = NULL;
+    cache->pool = NULL;
+    cache->capacity = 0;
+}
+
+/**
+ * @brief 让缓存块直接指向设备映像中的对应块，驱动不支持映射时返回 false
+ */
+static bool newfs_cache_map(struct newfs_buf *buf)
+{
+    uint8_t *data = ddriver_map_block(super.fd, (off_t)buf->block_no * NFS_BLKS_SZ(), NFS_BLKS_SZ(),
+                                      DDRIVER_MAP_READ);
+
+    if (data == NULL)
+    {
+        return false;
+    }
+    buf->data = data;
+    buf->mapped = true;
+    buf->valid = NFS_SECS_ALL();
+    super.cache.map_cnt++;
+    return true;
+}
+
+/**
+ * @brief 解除缓存块对设备映像的映射，改回使用缓存自己的内存
+ *
+ * @param copy 是否把映像内容拷贝过来（写时复制）
+ */
+static void newfs_cache_unmap(struct newfs_buf *buf, bool copy)
+{
+    struct newfs_cache *cache = &super.cache;
+    uint8_t *slot = NFS_CACHE_SLOT(cache, buf);
+
+    if (!buf->mapped)
+    {
+        return;
+    }
+    if (copy)
+    {
+        memcpy(slot, buf->data, NFS_BLKS_SZ());
+    }
+    ddriver_unmap_block(super.fd, buf->data, NFS_BLKS_SZ(), 0);
+    buf->data = slot;
+    buf->mapped = false;
+}
+
+/**
+ * @brief 在哈希表中查找缓存块
+ */
+static struct newfs_buf *newfs_cache_lookup(int block_no)
+{
+    struct newfs_cache *cache = &super.cache;
+    struct newfs_buf *buf = cache->hash[NFS_CACHE_HASH(cache, block_no)];
+
+    while (buf)
+    {
+        if (buf->block_no == block_no)
+        {
+            return buf;
+        }
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 将缓存块从哈希表中摘除
+ */
+static void newfs_cache_unhash(struct newfs_buf *buf)
+{
+    struct newfs_cache *cache = &super.cache;
+    struct newfs_buf **link = &cache->hash[NFS_CACHE_HASH(cache, buf->block_no)];
+
+    while (*link)
+    {
+        if (*link == buf)
+        {
+            *link = buf->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+/**
+ * @brief 按扇区位图 mask 中连续为 1 的区段，对缓存块执行设备读或写
+ */
+static int newfs_cache_io_runs(struct newfs_buf *buf, uint32_t mask, bool is_write)
+{
+    int sec = 0;
+    off_t base = (off_t)buf->block_no * NFS_BLKS_SZ();
+    int ret;
+
+    while (sec < NFS_SECS_PER_BLK())
+    {
+        int start;
+
+        if (!(mask & (1U << sec)))
+        {
+            sec++;
+            continue;
+        }
+        start = sec;
+        while (sec < NFS_SECS_PER_BLK() && (mask & (1U << sec)))
+        {
+            sec++;
+        }
+
+        if (is_write)
+        {
+            ret = newfs_dev_write(base + start * NFS_IO_SZ(),
+                                  buf->data + start * NFS_IO_SZ(),
+                                  (sec - start) * NFS_IO_SZ());
+        }
+        else
+        {
+            ret = newfs_dev_read(base + start * NFS_IO_SZ(),
+                                 buf->data + start * NFS_IO_SZ(),
+                                 (sec - start) * NFS_IO_SZ());
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将脏缓存块写回，只写有效扇区（无效扇区磁盘上的内容才是最新的）
+ */
+static int newfs_cache_writeback(struct newfs_buf *buf)
+{
+    int ret = newfs_cache_io_runs(buf, buf->valid, true);
+
+    if (ret == NFS_ERROR_NONE)
+    {
+        buf->is_dirty = false;
+        super.cache.dirty_cnt--;
+    }
+    return ret;
+}
+
+/**
+ * @brief 计算块内 [bias, bias + len) 覆盖到的扇区位图
+ *
+ * @param full 为 true 时只统计被完整覆盖的扇区
+ */
+static uint32_t newfs_cache_sec_mask(int bias, int len, bool full)
+{
+    int first, last;
+    uint32_t mask = 0;
+
+    if (full)
+    {
+        first = NFS_ROUND_UP(bias, NFS_IO_SZ()) / NFS_IO_SZ();
+        last = NFS_ROUND_DOWN(bias + len, NFS_IO_SZ()) / NFS_IO_SZ();
+    }
+    else
+    {
+        first = bias / NFS_IO_SZ();
+        last = NFS_ROUND_UP(bias + len, NFS_IO_SZ()) / NFS_IO_SZ();
+    }
+
+    for (int sec = first; sec < last; sec++)
+    {
+        mask |= 1U << sec;
+    }
+    return mask;
+}
+
+/**
+ * @brief CLOCK 算法选出一个可替换的缓存块
+ *
+ * 只置换干净块，脏块留在缓存中等日志事务提交后再写回：直接写回原位置会破坏事务的原子性，
+ * 在调用者的操作中途刷写又会提交半个操作。缓存中只剩脏块或被钉住的块时返回 NULL，
+ * 由调用者让当前操作失败；newfs_flush_if_needed 保证正常情况下留有足够的干净块。
+ * 调用者须持有全局锁
+ */
+static struct newfs_buf *newfs_cache_evict()
+{
+    struct newfs_cache *cache = &super.cache;
+    struct newfs_buf *buf;
+    int scanned = 0;
+
+    while (true)
+    {
+        buf = &cache->bufs[cache->clock_hand];
+        cache->clock_hand = (cache->clock_hand + 1) % cache->capacity;
+        scanned++;
+
+        if (buf->block_no == -1)
+        {
+            return buf;
+        }
+        if (scanned > 2 * cache->capacity)
+        {
+            return NULL;                          /* 没有可以置换的干净块 */
+        }
+        if (buf->pin > 0 || buf->is_dirty)
+        {
+            continue;
+        }
+        if (buf->ref)
+        {
+            buf->ref = false;
+            continue;
+        }
+        newfs_cache_unmap(buf, false);
+        newfs_cache_unhash(buf);
+        buf->block_no = -1;
+        buf->valid = 0;
+        cache->evict_cnt++;
+        return buf;
+    }
+}
+
+/**
+ * @brief 获取一个块在缓存中的内容，保证 [bias, bias + len) 范围可用
+ *
+ * 读访问时只读入范围内尚未有效的扇区；写访问时被完整覆盖的扇区直接视为有效，
+ * 只有部分覆盖且尚未有效的首尾扇区需要预读。
+ * 读访问未命中时优先直接映射设备映像；写访问命中映射块时先拷贝到缓存内存。
+ * 返回的指针在下一次调用 newfs_cache_get 之前有效，需要更久时使用 newfs_cache_pin。
+ *
+ * @param block_no 磁盘块号
+ * @param bias 块内偏移
+ * @param len 访问长度
+ * @param dirty 是否为写访问（调用者随后会写入该范围）
+ * @return uint8_t* 块内容，失败返回 NULL
+ */
+uint8_t *newfs_cache_get(int block_no, int bias, int len, bool dirty)
+{
+    struct newfs_cache *cache = &super.cache;
+    struct newfs_buf *buf = newfs_cache_lookup(block_no);
+    uint32_t touch = newfs_cache_sec_mask(bias, len, false);
+    uint32_t cover = dirty ? newfs_cache_sec_mask(bias, len, true) : 0;
+    uint32_t need;
+    int slot;
+
+    if (buf)
+    {
+        cache->hit_cnt++;
+    }
+    else
+    {
+        cache->miss_cnt++;
+        buf = newfs_cache_evict();
+        if (buf == NULL)
+        {
+            return NULL;
+        }
+
+        buf->block_no = block_no;
+        buf->valid = 0;
+        buf->is_dirty = false;
+        slot = NFS_CACHE_HASH(cache, block_no);
+        buf->hash_next = cache->hash[slot];
+        cache->hash[slot] = buf;
+        if (!dirty)
+        {
+            newfs_cache_map(buf);
+        }
+    }
+    if (dirty)
+    {
+        newfs_cache_unmap(buf, true);
+    }
+
+    /* 整扇区覆盖写：无需读入。有效位在读入成功之后才设置，
+       读失败时这些扇区中没有写入的内容，不能当作有效 */
+    need = touch & ~buf->valid & ~cover;
+    if (need && newfs_cache_io_runs(buf, need, false) < 0)
+    {
+        return NULL;
+    }
+    for (int sec = 0; sec < NFS_SECS_PER_BLK(); sec++)
+    {
+        if ((cover & ~buf->valid) & (1U << sec))
+        {
+            cache->skip_read_cnt++;
+        }
+    }
+    buf->valid |= cover | need;
+
+    buf->ref = true;
+    if (dirty && !buf->is_dirty)
+    {
+        buf->is_dirty = true;
+        cache->dirty_cnt++;
+    }
+    return buf->data;
+}
+
+/**
+ * @brief 钉住一个整块，供调用者在块内容上就地解析（inode、目录项、间接块等）
+ *
+ * 与 newfs_cache_get 不同，返回的指针在 newfs_cache_unpin 之前一直有效，
+ * 期间可以继续访问其他块。dirty 为 true 时整块先读入再标脏，调用者可以就地修改
+ *
+ * @param block_no 磁盘块号
+ * @param dirty 是否会修改块内容
+ * @return uint8_t* 块内容，失败返回 NULL
+ */
+uint8_t *newfs_cache_pin(int block_no, bool dirty)
+{
+    struct newfs_buf *buf;
+
+    if (newfs_cache_get(block_no, 0, NFS_BLKS_SZ(), false) == NULL)
+    {
+        return NULL;
+    }
+    if (dirty && newfs_cache_get(block_no, 0, NFS_BLKS_SZ(), true) == NULL)
+    {
+        return NULL;
+    }
+    buf = newfs_cache_lookup(block_no);
+    buf->pin++;
+    return buf->data;
+}
+
+/**
+ * @brief 解除 newfs_cache_pin
+ */
+void newfs_cache_unpin(int block_no)
+{
+    struct newfs_buf *buf = newfs_cache_lookup(block_no);
+
+    if (buf && buf->pin > 0)
+    {
+        buf->pin--;
+    }
+}
+
+static int newfs_buf_cmp(const void *a, const void *b)
+{
+    const struct newfs_buf *x = *(const struct newfs_buf **)a;
+    const struct newfs_buf *y = *(const struct newfs_buf **)b;
+    return x->block_no - y->block_no;
+}
+
+/**
+ * @brief 提交一批异步请求并等待全部完成；异步 I/O 不可用时逐个同步执行
+ *
+ * @return int 0成功，任一请求失败返回 -NFS_ERROR_IO
+ */
+int newfs_aio_run(struct ddriver_aio_req **reqs, int nr)
+{
+    struct ddriver_aio_req *done[NFS_AIO_DEPTH];
+    int submitted = 0, finished = 0;
+    int ret = NFS_ERROR_NONE;
+
+    if (!super.aio_enabled)
+    {
+        for (int i = 0; i < nr; i++)
+        {
+            if (reqs[i]->op == DDRIVER_AIO_WRITE)
+                reqs[i]->res = ddriver_pwritev(super.fd, reqs[i]->iov, reqs[i]->iovcnt, reqs[i]->offset);
+            else
+                reqs[i]->res = ddriver_preadv(super.fd, reqs[i]->iov, reqs[i]->iovcnt, reqs[i]->offset);
+            if (reqs[i]->res < 0)
+                ret = -NFS_ERROR_IO;
+        }
+        return ret;
+    }
+
+    while (finished < nr)
+    {
+        if (submitted < nr)
+        {
+            int cnt = ddriver_aio_submit(super.fd, reqs + submitted, nr - submitted);
+            if (cnt < 0)
+            {
+                /* 无法提交的请求直接算作失败，已提交的仍需等待完成 */
+                for (int i = submitted; i < nr; i++)
+                    reqs[i]->res = cnt;
+                finished += nr - submitted;
+                submitted = nr;
+                ret = -NFS_ERROR_IO;
+                continue;
+            }
+            submitted += cnt;
+        }
+
+        int got = ddriver_aio_wait(super.fd, done, 1, NFS_AIO_DEPTH);
+        if (got < 0)
+        {
+            /* 驱动已经无法收割完成事件，剩下的请求无从等待 */
+            ret = -NFS_ERROR_IO;
+            break;
+        }
+        for (int i = 0; i < got; i++)
+        {
+            if (done[i]->res < 0)
+                ret = -NFS_ERROR_IO;
+        }
+        finished += got;
+    }
+    return ret;
+}
+
+/**
+ * @brief 预读一组块到缓存，所有读请求一次提交、重叠完成
+ *
+ * 已在缓存中的块会被跳过；单次预读的块数不超过缓存容量的一半，避免互相置换
+ *
+ * @param blks 块号数组
+ * @param nr 块数
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_cache_prefetch(const int *blks, int nr)
+{
+    struct newfs_cache *cache = &super.cache;
+    struct ddriver_aio_req *reqs, **preqs;
+    struct iovec *iov;
+    int cnt = 0, ret;
+
+    if (nr > cache->capacity / 2)
+    {
+        nr = cache->capacity / 2;
+    }
+    if (nr <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    reqs = (struct ddriver_aio_req *)calloc(nr, sizeof(struct ddriver_aio_req));
+    preqs = (struct ddriver_aio_req **)calloc(nr, sizeof(struct ddriver_aio_req *));
+    iov = (struct iovec *)calloc(nr, sizeof(struct iovec));
+    if (reqs == NULL || preqs == NULL || iov == NULL)
+    {
+        free(reqs);
+        free(preqs);
+        free(iov);
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    for (int i = 0; i < nr; i++)
+    {
+        struct newfs_buf *buf;
+        int slot;
+
+        if (newfs_cache_lookup(blks[i]))
+        {
+            continue;
+        }
+        buf = newfs_cache_evict();
+        if (buf == NULL)
+        {
+            break;
+        }
+
+        buf->block_no = blks[i];
+        buf->valid = 0;
+        buf->is_dirty = false;
+        buf->ref = true;
+        slot = NFS_CACHE_HASH(cache, blks[i]);
+        buf->hash_next = cache->hash[slot];
+        cache->hash[slot] = buf;
+        if (newfs_cache_map(buf))
+        {
+            continue;
+        }
+
+        /* 读请求完成之前钉住，本批后面的块不会再置换到它 */
+        buf->pin++;
+        iov[cnt].iov_base = buf->data;
+        iov[cnt].iov_len = NFS_BLKS_SZ();
+        reqs[cnt].op = DDRIVER_AIO_READ;
+        reqs[cnt].offset = (off_t)blks[i] * NFS_BLKS_SZ();
+        reqs[cnt].iov = &iov[cnt];
+        reqs[cnt].iovcnt = 1;
+        reqs[cnt].priv = buf;
+        preqs[cnt] = &reqs[cnt];
+        cnt++;
+    }
+    cache->miss_cnt += cnt;
+
+    ret = newfs_aio_run(preqs, cnt);
+    for (int i = 0; i < cnt; i++)
+    {
+        struct newfs_buf *buf = (struct newfs_buf *)reqs[i].priv;
+
+        /* 读失败的块保持无效，之后访问时会重新读取 */
+        if (reqs[i].res == NFS_BLKS_SZ())
+        {
+            buf->valid = NFS_SECS_ALL();
+        }
+        buf->pin--;
+    }
+
+    free(reqs);
+    free(preqs);
+    free(iov);
+    return ret;
+}
+
+/**
+ * @brief 将一组脏块按块号升序写回磁盘
+ *
+ * 块号连续且整块有效的脏块合并为一个向量写请求，所有请求一次性异步提交
+ */
+static int newfs_cache_sync_bufs(struct newfs_buf **dirty_bufs, int dirty_cnt)
+{
+    struct newfs_cache *cache = &super.cache;
+    struct ddriver_aio_req *reqs, **preqs;
+    struct iovec *iov;
+    int req_cnt = 0;
+    int ret = NFS_ERROR_NONE;
+
+    reqs = (struct ddriver_aio_req *)calloc(dirty_cnt + 1, sizeof(struct ddriver_aio_req));
+    preqs = (struct ddriver_aio_req **)calloc(dirty_cnt + 1, sizeof(struct ddriver_aio_req *));
+    iov = (struct iovec *)calloc(dirty_cnt + 1, sizeof(struct iovec));
+    if (reqs == NULL || preqs == NULL || iov == NULL)
+    {
+        ret = -NFS_ERROR_NOSPACE;
+        goto out;
+    }
+
+    qsort(dirty_bufs, dirty_cnt, sizeof(struct newfs_buf *), newfs_buf_cmp);
+
+    for (int i = 0; i < dirty_cnt; )
+    {
+        int run = 1;
+
+        /* 只有部分扇区有效的块按有效区段同步写回 */
+        if (dirty_bufs[i]->valid != NFS_SECS_ALL())
+        {
+            if (newfs_cache_writeback(dirty_bufs[i]) < 0)
+            {
+                ret = -NFS_ERROR_IO;
+            }
+            cache->flush_cnt++;
+            i++;
+            continue;
+        }
+
+        while (i + run < dirty_cnt && run < NFS_CACHE_MAX_IOV
+               && dirty_bufs[i + run]->block_no == dirty_bufs[i]->block_no + run
+               && dirty_bufs[i + run]->valid == NFS_SECS_ALL())
+        {
+            run++;
+        }
+
+        for (int j = 0; j < run; j++)
+        {
+            iov[i + j].iov_base = dirty_bufs[i + j]->data;
+            iov[i + j].iov_len = NFS_BLKS_SZ();
+        }
+        reqs[req_cnt].op = DDRIVER_AIO_WRITE;
+        reqs[req_cnt].offset = (off_t)dirty_bufs[i]->block_no * NFS_BLKS_SZ();
+        reqs[req_cnt].iov = &iov[i];
+        reqs[req_cnt].iovcnt = run;
+        reqs[req_cnt].priv = &dirty_bufs[i];
+        preqs[req_cnt] = &reqs[req_cnt];
+        req_cnt++;
+        i += run;
+    }
+
+    if (newfs_aio_run(preqs, req_cnt) != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    for (int i = 0; i < req_cnt; i++)
+    {
+        struct newfs_buf **run_bufs = (struct newfs_buf **)reqs[i].priv;
+
+        if (reqs[i].res < 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < reqs[i].iovcnt; j++)
+        {
+            run_bufs[j]->is_dirty = false;
+        }
+        cache->dirty_cnt -= reqs[i].iovcnt;
+        cache->flush_cnt += reqs[i].iovcnt;
+    }
+
+out:
+    free(reqs);
+    free(preqs);
+    free(iov);
+    return ret;
+}
+
+/**
+ * @brief 将所有脏块按块号升序写回磁盘
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_cache_sync()
+{
+    struct newfs_cache *cache = &super.cache;
+    struct newfs_buf **dirty_bufs;
+    int dirty_cnt = 0, ret;
+
+    if (cache->capacity == 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    dirty_bufs = (struct newfs_buf **)malloc(cache->capacity * sizeof(struct newfs_buf *));
+    if (dirty_bufs == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (int i = 0; i < cache->capacity; i++)
+    {
+        if (cache->bufs[i].block_no != -1 && cache->bufs[i].is_dirty)
+        {
+            dirty_bufs[dirty_cnt++] = &cache->bufs[i];
+        }
+    }
+
+    ret = newfs_cache_sync_bufs(dirty_bufs, dirty_cnt);
+    free(dirty_bufs);
+    return ret;
+}
+
+/**
+ * @brief 只写回指定的块（不在缓存中或不脏的块被忽略）
+ *
+ * @param blks 块号数组
+ * @param nr 块数
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_cache_sync_blks(const int *blks, int nr)
+{
+    struct newfs_buf **dirty_bufs;
+    int dirty_cnt = 0, ret;
+
+    dirty_bufs = (struct newfs_buf **)malloc((nr + 1) * sizeof(struct newfs_buf *));
+    if (dirty_bufs == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (int i = 0; i < nr; i++)
+    {
+        struct newfs_buf *buf = newfs_cache_lookup(blks[i]);
+        if (buf && buf->is_dirty)
+        {
+            dirty_bufs[dirty_cnt++] = buf;
+        }
+    }
+
+    ret = newfs_cache_sync_bufs(dirty_bufs, dirty_cnt);
+    free(dirty_bufs);
+    return ret;
+}
+
+/**
+ * @brief 按块号升序列出缓存中的脏块
+ *
+ * @param blks 输出块号
+ * @param max blks 数组大小
+ * @return int 脏块数
+ */
+int newfs_cache_dirty_blks(int *blks, int max)
+{
+    struct newfs_cache *cache = &super.cache;
+    int cnt = 0;
+
+    for (int i = 0; i < cache->capacity && cnt < max; i++)
+    {
+        if (cache->bufs[i].block_no != -1 && cache->bufs[i].is_dirty)
+        {
+            blks[cnt++] = cache->bufs[i].block_no;
+        }
+    }
+    for (int i = 1; i < cnt; i++)                 /* 插入排序，脏块数通常很少 */
+    {
+        int blk = blks[i], j = i - 1;
+        while (j >= 0 && blks[j] > blk)
+        {
+            blks[j + 1] = blks[j];
+            j--;
+        }
+        blks[j + 1] = blk;
+    }
+    return cnt;
+}
+
+/**
+ * @brief 直接查看缓存块内容，不触发任何 I/O
+ *
+ * @param block_no 磁盘块号
+ * @param valid 输出有效扇区位图
+ * @return uint8_t* 块内容，不在缓存中返回 NULL
+ */
+uint8_t *newfs_cache_peek(int block_no, uint32_t *valid)
+{
+    struct newfs_buf *buf = newfs_cache_lookup(block_no);
+
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+    *valid = buf->valid;
+    return buf->data;
+}
+
+/**
+ * @brief 丢弃一个块的缓存内容（包括未写回的修改）
+ *
+ * 释放间接块时调用，避免该块重新分配为文件数据后被旧的缓存内容覆盖
+ */
+void newfs_cache_forget(int block_no)
+{
+    struct newfs_buf *buf = newfs_cache_lookup(block_no);
+
+    if (buf == NULL || buf->pin > 0)
+    {
+        return;
+    }
+    if (buf->is_dirty)
+    {
+        super.cache.dirty_cnt--;
+    }
+    newfs_cache_unmap(buf, false);
+    newfs_cache_unhash(buf);
+    buf->block_no = -1;
+    buf->valid = 0;
+    buf->is_dirty = false;
+}
+
+/******************************************************************************
+* SECTION: 设备读写（绕过缓存）
+*******************************************************************************/
+/**
+ * @brief 从设备读取连续扇区，offset 与 size 须按 NFS_IO_SZ 对齐，一次驱动调用完成
+ */
+int newfs_dev_read(off_t offset, uint8_t *buf, int size)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    int ret = ddriver_preadv(super.fd, &iov, 1, offset);
+
+    return ret < 0 ? ret : NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 向设备写入连续扇区，offset 与 size 须按 NFS_IO_SZ 对齐，一次驱动调用完成
+ */
+int newfs_dev_write(off_t offset, uint8_t *buf, int size)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    int ret = ddriver_pwritev(super.fd, &iov, 1, offset);
+
+    return ret < 0 ? ret : NFS_ERROR_NONE;
+}
@@ -0,0 +1,184 @@
+#include "newfs.h"
+
+/******************************************************************************
+* SECTION: 路径缓存
+*
+* 完整路径 -> newfs_lookup 结果的全局缓存，命中时一次哈希探测即可返回，
+* 不做 strtok 分词，也不分配内存：
+*   - 直接映射，每个路径只可能落在一个槽中，冲突时新项覆盖旧项
+*   - 正项记录找到的 dentry，负项记录"不存在"以及查找停下处的 dentry，
+*     mknod / mkdir 判断目标是否已存在时同样可以命中
+*   - 失效通过代数完成：mkdir / mknod 使所有负项失效，
+*     从目录中摘除目录项（newfs_drop_dentry）使全部缓存失效，都不需要扫描整个表
+*   - 调用者持有 NFS_LOCK
+*******************************************************************************/
+extern struct newfs_super super;
+
+/**
+ * @brief 路径哈希（FNV-1a），结果为 0 时改为 1，0 表示空槽
+ */
+static uint32_t newfs_dcache_hash(const char *path, int *len)
+{
+    uint32_t hash = 2166136261U;
+    const char *p = path;
+
+    while (*p)
+    {
+        hash ^= (uint8_t)*p++;
+        hash *= 16777619U;
+    }
+    *len = p - path;
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief 初始化路径缓存
+ *
+ * @param slots 槽数，向上取整为 2 的幂
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_dcache_init(int slots)
+{
+    struct newfs_dcache *dcache = &super.dcache;
+    int sz = 1;
+
+    while (sz < slots)
+    {
+        sz <<= 1;
+    }
+
+    memset(dcache, 0, sizeof(struct newfs_dcache));
+    dcache->entries = (struct newfs_dcache_entry *)calloc(sz, sizeof(struct newfs_dcache_entry));
+    if (dcache->entries == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    dcache->slots = sz;
+    dcache->pos_gen = 1;
+    dcache->neg_gen = 1;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放路径缓存
+ */
+void newfs_dcache_destroy()
+{
+    struct newfs_dcache *dcache = &super.dcache;
+
+    free(dcache->entries);
+    dcache->entries = NULL;
+    dcache->slots = 0;
+}
+
+/**
+ * @brief 查找路径缓存
+ *
+ * @param path 路径
+ * @param is_find 命中时返回路径是否存在
+ * @return struct newfs_dentry* 命中时返回与 newfs_lookup 相同的 dentry，未命中返回 NULL
+ */
+struct newfs_dentry *newfs_dcache_lookup(const char *path, bool *is_find)
+{
+    struct newfs_dcache *dcache = &super.dcache;
+    struct newfs_dcache_entry *entry;
+    uint32_t hash;
+    int len;
+
+    if (dcache->entries == NULL)
+    {
+        return NULL;
+    }
+
+    hash = newfs_dcache_hash(path, &len);
+    entry = &dcache->entries[hash & (dcache->slots - 1)];
+    if (entry->hash != hash || entry->pos_gen != dcache->pos_gen ||
+        (!entry->is_find && entry->neg_gen != dcache->neg_gen) ||
+        memcmp(entry->path, path, len + 1) != 0)
+    {
+        dcache->miss_cnt++;
+        return NULL;
+    }
+
+    if (entry->is_find)
+    {
+        dcache->hit_cnt++;
+    }
+    else
+    {
+        dcache->neg_hit_cnt++;
+    }
+    *is_find = entry->is_find;
+    return entry->dentry;
+}
+
+/**
+ * @brief 记录一次 newfs_lookup 的结果
+ *
+ * @param path 路径，过长时不缓存
+ * @param dentry 找到的 dentry 或最后一个有效的 dentry
+ * @param is_find 是否找到
+ */
+void newfs_dcache_insert(const char *path, struct newfs_dentry *dentry, bool is_find)
+{
+    struct newfs_dcache *dcache = &super.dcache;
+    struct newfs_dcache_entry *entry;
+    uint32_t hash;
+    int len;
+
+    if (dcache->entries == NULL || dentry == NULL)
+    {
+        return;
+    }
+
+    hash = newfs_dcache_hash(path, &len);
+    if (len >= NFS_DCACHE_PATH_LEN)
+    {
+        return;
+    }
+
+    entry = &dcache->entries[hash & (dcache->slots - 1)];
+    entry->hash = hash;
+    entry->pos_gen = dcache->pos_gen;
+    entry->neg_gen = dcache->neg_gen;
+    entry->is_find = is_find;
+    entry->dentry = dentry;
+    memcpy(entry->path, path, len + 1);
+}
+
+/**
+ * @brief 路径被创建后使缓存失效
+ *
+ * 删除该路径自身的项；所有负项都可能记录了该路径或其上级，一并失效
+ *
+ * @param path 被创建的路径
+ */
+void newfs_dcache_invalidate(const char *path)
+{
+    struct newfs_dcache *dcache = &super.dcache;
+    struct newfs_dcache_entry *entry;
+    uint32_t hash;
+    int len;
+
+    if (dcache->entries == NULL)
+    {
+        return;
+    }
+
+    hash = newfs_dcache_hash(path, &len);
+    entry = &dcache->entries[hash & (dcache->slots - 1)];
+    if (entry->hash == hash)
+    {
+        entry->hash = 0;
+    }
+    dcache->neg_gen++;
+}
+
+/**
+ * @brief 使全部缓存失效（被摘除的目录项及其子树可能还被缓存项引用）
+ */
+void newfs_dcache_flush()
+{
+    super.dcache.pos_gen++;
+    super.dcache.neg_gen++;
+}
@@ -0,0 +1,603 @@
+#include "newfs.h"
+
+/******************************************************************************
+* SECTION: 增量刷写与日志
+*
+* 元数据修改只改内存并登记为脏：
+*   - 脏 inode 挂在 super.dirty_inodes 上，目录 inode 变脏时只重写新目录项所在的块
+*   - 位图只记录被修改的字节区间
+* 文件数据不进日志：newfs_flush 先写回页缓存中的脏页（ordered 模式），
+* 保证即将提交的元数据引用的数据块已经落盘。
+* 随后把这些脏元数据序列化进块缓存，再以日志事务的方式落盘：
+*   1. 把脏块映像连同描述块一次写入日志区
+*   2. 写提交块，事务生效
+*   3. 把脏块写回原位置
+*   4. 清除描述块
+* 崩溃后挂载时重放已提交但未清除的事务，未提交的事务直接丢弃。
+* 被释放的数据块在事务提交之后才交还分配器，提交之前不会被新数据覆盖。
+* 后台线程每隔 flush_interval 秒调用一次 newfs_flush，崩溃最多丢失一个周期的修改。
+*******************************************************************************/
+extern struct newfs_super super;
+
+#define NFS_JOURNAL_TX_BLKS()   (super.journal_blks - 2 < NFS_JOURNAL_MAX_ENTS ? \
+                                 super.journal_blks - 2 : NFS_JOURNAL_MAX_ENTS)
+/* 一次刷写的脏块上限：装得进一个事务，并给刷写过程中读入的块留出一半缓存 */
+#define NFS_FLUSH_MAX_BLKS()    (NFS_JOURNAL_TX_BLKS() < super.cache.capacity / 2 ? \
+                                 NFS_JOURNAL_TX_BLKS() : super.cache.capacity / 2)
+#define NFS_FLUSH_OP_BLKS       24   /* 单个操作最多新弄脏的块数，截断按 NFS_TRUNC_CHUNK 分段以满足 */
+
+/**
+ * @brief 登记脏 inode，重复登记无副作用
+ */
+void newfs_mark_inode_dirty(struct newfs_inode *inode)
+{
+    if (inode == NULL || inode->is_dirty)
+    {
+        return;
+    }
+    inode->is_dirty = true;
+    inode->dirty_next = super.dirty_inodes;
+    super.dirty_inodes = inode;
+    super.dirty_inode_cnt++;
+}
+
+/**
+ * @brief 在数据位图中清除（clear 为 true）或恢复待释放块的位
+ *
+ * 刷写时位图以清除后的样子写入事务，写完立即恢复，事务提交前分配器仍把它们当作已分配
+ */
+static void newfs_free_pending_mark(bool clear)
+{
+    for (int i = 0; i < super.free_pending_cnt; i++)
+    {
+        int block_no = super.free_pending[i];
+        struct newfs_group *grp = &super.groups[NFS_BLK_GROUP(block_no)];
+        int idx = block_no - grp->data_offset;
+
+        if (clear)
+        {
+            grp->map_data[idx / 8] &= ~(uint8_t)(1 << (idx % 8));
+        }
+        else
+        {
+            grp->map_data[idx / 8] |= (uint8_t)(1 << (idx % 8));
+        }
+    }
+}
+
+/**
+ * @brief 事务提交后把待释放的块交还分配器
+ */
+static void newfs_free_pending_release()
+{
+    for (int i = 0; i < super.free_pending_cnt; i++)
+    {
+        int block_no = super.free_pending[i];
+        struct newfs_group *grp = &super.groups[NFS_BLK_GROUP(block_no)];
+
+        if (newfs_bitmap_free(grp->map_data, block_no - grp->data_offset))
+        {
+            grp->data_free++;
+            super.data_free++;
+        }
+    }
+    super.free_pending_cnt = 0;
+}
+
+/**
+ * @brief 把 inode 从脏链表中摘除，释放 inode 之前调用
+ */
+void newfs_clear_inode_dirty(struct newfs_inode *inode)
+{
+    struct newfs_inode **link = &super.dirty_inodes;
+
+    if (!inode->is_dirty)
+    {
+        return;
+    }
+    while (*link && *link != inode)
+    {
+        link = &(*link)->dirty_next;
+    }
+    if (*link)
+    {
+        *link = inode->dirty_next;
+        super.dirty_inode_cnt--;
+    }
+    inode->is_dirty = false;
+    inode->dirty_next = NULL;
+}
+
+/**
+ * @brief 估计下一次刷写会写入日志的块数
+ *
+ * 包括块缓存中已有的脏块、位图脏字节跨越的块、超级块、每个脏 inode 的 inode 块
+ * 及其目录块（增量打包只重写最后一块，另加为新目录项预留的块；整体重新打包时为全部目录块），
+ * 以及延迟分配会弄脏的间接块和位图块。
+ * 脏 inode 数不会超过一个事务的块数，遍历脏链表的开销有限
+ */
+static int newfs_flush_blks()
+{
+    int blks = super.cache.dirty_cnt + newfs_pcache_meta_blks() + 1;
+
+    for (struct newfs_inode *inode = super.dirty_inodes; inode; inode = inode->dirty_next)
+    {
+        blks += 1;
+        if (NFS_IS_DIR(inode))
+        {
+            blks += (inode->dir_tail ? 1 : inode->size / NFS_BLKS_SZ()) + inode->resv_blks;
+        }
+    }
+    for (int g = 0; g < super.group_cnt; g++)
+    {
+        struct newfs_group *group = &super.groups[g];
+
+        if (group->ino_map_dirty_lo < group->ino_map_dirty_hi)
+        {
+            blks += (group->ino_map_dirty_hi - 1) / NFS_BLKS_SZ() - group->ino_map_dirty_lo / NFS_BLKS_SZ() + 1;
+        }
+        if (group->data_map_dirty_lo < group->data_map_dirty_hi)
+        {
+            blks += (group->data_map_dirty_hi - 1) / NFS_BLKS_SZ() - group->data_map_dirty_lo / NFS_BLKS_SZ() + 1;
+        }
+    }
+    return blks;
+}
+
+/**
+ * @brief 再来一个操作就可能装不下一个日志事务时提前刷写，保证每次刷写都是一个完整事务
+ *
+ * 待释放的块多于剩余空闲块时也提前刷写，让它们尽早可以再分配。
+ * 应在一个操作完成、元数据处于一致状态时调用，调用者须持有全局锁
+ */
+void newfs_flush_if_needed()
+{
+    if (newfs_flush_blks() + NFS_FLUSH_OP_BLKS > NFS_FLUSH_MAX_BLKS()
+        || super.free_pending_cnt > super.data_free)
+    {
+        if (newfs_flush() != NFS_ERROR_NONE)
+        {
+            printf("[NEWFS] Error: early flush failed\n");
+        }
+    }
+}
+
+/**
+ * @brief 将内存超级块写入块缓存
+ */
+static int newfs_sync_super()
+{
+    struct newfs_super_d super_d;
+
+    memset(&super_d, 0, sizeof(struct newfs_super_d));
+    super_d.magic_number = NFS_MAGIC_NUM;
+    super_d.sz_usage = super.sz_usage;
+    super_d.sz_blks = super.sz_blks;
+    super_d.blks_num = super.blks_num;
+
+    super_d.sb_offset = super.sb_offset;
+    super_d.sb_blks = super.sb_blks;
+
+    super_d.ino_bitmap_offset = super.ino_bitmap_offset;
+    super_d.ino_bitmap_blks = super.ino_bitmap_blks;
+
+    super_d.data_bitmap_offset = super.data_bitmap_offset;
+    super_d.data_bitmap_blks = super.data_bitmap_blks;
+
+    super_d.inode_offset = super.inode_offset;
+    super_d.inode_blks = super.inode_blks;
+
+    super_d.data_offset = super.data_offset;
+    super_d.data_blks = super.data_blks;
+
+    super_d.max_ino = super.max_ino;
+    super_d.file_max = super.file_max;
+    super_d.root_ino = super.root_ino;
+
+    super_d.journal_offset = super.journal_offset;
+    super_d.journal_blks = super.journal_blks;
+
+    super_d.group_cnt = super.group_cnt;
+    super_d.blks_per_group = super.blks_per_group;
+    super_d.inos_per_group = super.inos_per_group;
+
+    return newfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&super_d,
+                              sizeof(struct newfs_super_d));
+}
+
+static uint32_t newfs_journal_checksum(const uint8_t *buf, int size)
+{
+    uint32_t hash = 2166136261U;                      /* FNV-1a */
+
+    for (int i = 0; i < size; i++)
+    {
+        hash ^= buf[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief 清除日志描述块，使日志区不含任何事务
+ */
+static int newfs_journal_clear()
+{
+    uint8_t *blk = (uint8_t *)calloc(1, NFS_BLKS_SZ());
+    int ret;
+
+    if (blk == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    ret = newfs_dev_write((off_t)super.journal_offset * NFS_BLKS_SZ(), blk, NFS_BLKS_SZ());
+    free(blk);
+    return ret < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 以一个事务提交一组脏块：写日志、写提交块、写回原位置、清除日志
+ */
+static int newfs_journal_tx(const int *blks, int nr)
+{
+    struct newfs_journal_d *jd;
+    struct newfs_commit_d *cd;
+    uint8_t *buf;
+    int ret = NFS_ERROR_NONE;
+
+    /* 描述块 + nr 个块映像 + 提交块，连续存放 */
+    buf = (uint8_t *)calloc(nr + 2, NFS_BLKS_SZ());
+    if (buf == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    jd = (struct newfs_journal_d *)buf;
+    jd->magic = NFS_JOURNAL_MAGIC;
+    jd->seq = ++super.journal_seq;
+    jd->nr = nr;
+    for (int i = 0; i < nr; i++)
+    {
+        uint32_t valid;
+        uint8_t *data = newfs_cache_peek(blks[i], &valid);
+
+        if (data == NULL)
+        {
+            ret = -NFS_ERROR_IO;
+            goto out;
+        }
+        jd->blks[i].block_no = blks[i];
+        jd->blks[i].valid = valid;
+        memcpy(buf + (i + 1) * NFS_BLKS_SZ(), data, NFS_BLKS_SZ());
+    }
+
+    cd = (struct newfs_commit_d *)(buf + (nr + 1) * NFS_BLKS_SZ());
+    cd->magic = NFS_COMMIT_MAGIC;
+    cd->seq = jd->seq;
+    cd->checksum = newfs_journal_checksum(buf, (nr + 1) * NFS_BLKS_SZ());
+
+    /* 提交块必须在描述块和映像落盘之后再写 */
+    if (newfs_dev_write((off_t)super.journal_offset * NFS_BLKS_SZ(), buf, (nr + 1) * NFS_BLKS_SZ()) < 0
+        || newfs_dev_write((off_t)(super.journal_offset + nr + 1) * NFS_BLKS_SZ(),
+                           (uint8_t *)cd, NFS_BLKS_SZ()) < 0)
+    {
+        ret = -NFS_ERROR_IO;
+        goto out;
+    }
+
+    ret = newfs_cache_sync_blks(blks, nr);
+    if (ret == NFS_ERROR_NONE)
+    {
+        ret = newfs_journal_clear();
+    }
+    super.journal_tx_cnt++;
+
+out:
+    free(buf);
+    return ret;
+}
+
+/**
+ * @brief 将缓存中的所有脏块作为一个日志事务落盘
+ *
+ * 拆成多个事务时崩溃可能只留下前一半，因此一个事务装不下时拒绝提交，脏块留在缓存中。
+ * newfs_flush_if_needed 保证正常情况下不会走到这一步
+ */
+static int newfs_journal_commit()
+{
+    int *blks;
+    int nr, ret;
+
+    blks = (int *)malloc(super.cache.capacity * sizeof(int));
+    if (blks == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    nr = newfs_cache_dirty_blks(blks, super.cache.capacity);
+
+    if (nr > NFS_JOURNAL_TX_BLKS())
+    {
+        printf("[NEWFS] Error: %d dirty blocks exceed one journal transaction (%d)\n",
+               nr, NFS_JOURNAL_TX_BLKS());
+        ret = -NFS_ERROR_NOSPACE;
+    }
+    else
+    {
+        ret = nr > 0 ? newfs_journal_tx(blks, nr) : NFS_ERROR_NONE;
+    }
+    free(blks);
+    return ret;
+}
+
+/**
+ * @brief 刷写所有脏数据：文件脏页、脏 inode 及其目录项、位图脏字节、超级块
+ *
+ * 调用者须持有全局锁（挂载与卸载阶段除外）
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_flush()
+{
+    struct newfs_inode *inode, *next;
+    int ret = NFS_ERROR_NONE;
+    bool data_failed = false;
+
+    /* 数据先于元数据 */
+    if (newfs_pcache_sync() != NFS_ERROR_NONE)
+    {
+        data_failed = true;
+        ret = -NFS_ERROR_IO;
+    }
+
+    /* inode 先于位图：刷写目录时可能为其分配数据块 */
+    inode = super.dirty_inodes;
+    super.dirty_inodes = NULL;
+    super.dirty_inode_cnt = 0;
+    while (inode)
+    {
+        next = inode->dirty_next;
+        inode->is_dirty = false;
+        inode->dirty_next = NULL;
+        /* 数据没有全部写回的文件留到下一次刷写，不提交指向未写入数据的映射 */
+        if (data_failed && newfs_pcache_has_dirty(inode))
+        {
+            newfs_mark_inode_dirty(inode);
+            inode = next;
+            continue;
+        }
+        /* 写入失败的 inode 重新登记，下一次刷写再试 */
+        if (newfs_sync_inode(inode) != NFS_ERROR_NONE)
+        {
+            newfs_mark_inode_dirty(inode);
+            ret = -NFS_ERROR_IO;
+        }
+        super.flush_inode_cnt++;
+        inode = next;
+    }
+
+    newfs_free_pending_mark(true);
+    for (int g = 0; g < super.group_cnt; g++)
+    {
+        struct newfs_group *group = &super.groups[g];
+
+        if (group->ino_map_dirty_lo < group->ino_map_dirty_hi)
+        {
+            if (newfs_driver_write((off_t)group->ino_bitmap_offset * NFS_BLKS_SZ() + group->ino_map_dirty_lo,
+                                   group->map_inode + group->ino_map_dirty_lo,
+                                   group->ino_map_dirty_hi - group->ino_map_dirty_lo) != NFS_ERROR_NONE)
+            {
+                ret = -NFS_ERROR_IO;
+            }
+            else
+            {
+                group->ino_map_dirty_lo = group->ino_map_dirty_hi = 0;
+            }
+        }
+
+        if (group->data_map_dirty_lo < group->data_map_dirty_hi)
+        {
+            if (newfs_driver_write((off_t)group->data_bitmap_offset * NFS_BLKS_SZ() + group->data_map_dirty_lo,
+                                   group->map_data + group->data_map_dirty_lo,
+                                   group->data_map_dirty_hi - group->data_map_dirty_lo) != NFS_ERROR_NONE)
+            {
+                ret = -NFS_ERROR_IO;
+            }
+            else
+            {
+                group->data_map_dirty_lo = group->data_map_dirty_hi = 0;
+            }
+        }
+    }
+    newfs_free_pending_mark(false);
+
+    if (super.sb_dirty)
+    {
+        if (newfs_sync_super() != NFS_ERROR_NONE)
+        {
+            ret = -NFS_ERROR_IO;
+        }
+        else
+        {
+            super.sb_dirty = false;
+        }
+    }
+
+    if (newfs_journal_commit() != NFS_ERROR_NONE)
+    {
+        ret = -NFS_ERROR_IO;
+    }
+    else if (ret == NFS_ERROR_NONE)
+    {
+        newfs_free_pending_release();
+    }
+    super.flush_cnt++;
+    return ret;
+}
+
+/**
+ * @brief 格式化时清空日志区，避免把旧介质上的残留当作事务重放
+ */
+int newfs_journal_format()
+{
+    super.journal_seq = 0;
+    return newfs_journal_clear();
+}
+
+/**
+ * @brief 挂载时重放已提交的日志事务
+ *
+ * 块映像经块缓存写回原位置，重放后缓存与磁盘一致；未提交或校验失败的事务被丢弃
+ *
+ * @return int 重放的块数，负数为错误号
+ */
+int newfs_journal_replay()
+{
+    struct newfs_journal_d *jd;
+    struct newfs_commit_d *cd;
+    uint8_t *buf;
+    int nr, ret = 0;
+
+    super.journal_seq = 0;
+    buf = (uint8_t *)malloc((size_t)super.journal_blks * NFS_BLKS_SZ());
+    if (buf == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (newfs_dev_read((off_t)super.journal_offset * NFS_BLKS_SZ(), buf, NFS_BLKS_SZ()) < 0)
+    {
+        free(buf);
+        return -NFS_ERROR_IO;
+    }
+
+    jd = (struct newfs_journal_d *)buf;
+    nr = jd->nr;
+    if (jd->magic != NFS_JOURNAL_MAGIC)
+    {
+        free(buf);
+        return 0;
+    }
+    super.journal_seq = jd->seq;
+    if (nr <= 0 || nr > NFS_JOURNAL_TX_BLKS())
+    {
+        goto discard;
+    }
+
+    if (newfs_dev_read((off_t)(super.journal_offset + 1) * NFS_BLKS_SZ(),
+                       buf + NFS_BLKS_SZ(), (nr + 1) * NFS_BLKS_SZ()) < 0)
+    {
+        free(buf);
+        return -NFS_ERROR_IO;
+    }
+    cd = (struct newfs_commit_d *)(buf + (nr + 1) * NFS_BLKS_SZ());
+    if (cd->magic != NFS_COMMIT_MAGIC || cd->seq != jd->seq
+        || cd->checksum != newfs_journal_checksum(buf, (nr + 1) * NFS_BLKS_SZ()))
+    {
+        goto discard;
+    }
+
+    for (int i = 0; i < nr; i++)
+    {
+        uint8_t *img = buf + (i + 1) * NFS_BLKS_SZ();
+        off_t base = (off_t)jd->blks[i].block_no * NFS_BLKS_SZ();
+
+        for (int sec = 0; sec < NFS_SECS_PER_BLK(); sec++)
+        {
+            if (!(jd->blks[i].valid & (1U << sec)))
+            {
+                continue;
+            }
+            if (newfs_driver_write(base + sec * NFS_IO_SZ(), img + sec * NFS_IO_SZ(),
+                                   NFS_IO_SZ()) != NFS_ERROR_NONE)
+            {
+                free(buf);
+                return -NFS_ERROR_IO;
+            }
+        }
+    }
+    if (newfs_cache_sync() != NFS_ERROR_NONE)
+    {
+        free(buf);
+        return -NFS_ERROR_IO;
+    }
+    ret = nr;
+
+discard:
+    free(buf);
+    if (newfs_journal_clear() != NFS_ERROR_NONE)
+    {
+        return -NFS_ERROR_IO;
+    }
+    return ret;
+}
+
+static void *newfs_flusher(void *arg)
+{
+    int interval = *(int *)arg;
+    struct timespec ts;
+
+    free(arg);
+    NFS_LOCK();
+    while (!super.flusher_stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += interval;
+        pthread_cond_timedwait(&super.flush_cond, &super.lock, &ts);
+        if (super.flusher_stop)
+        {
+            break;
+        }
+        if (newfs_flush() != NFS_ERROR_NONE)
+        {
+            printf("[NEWFS] Error: periodic flush failed\n");
+        }
+    }
+    NFS_UNLOCK();
+    return NULL;
+}
+
+/**
+ * @brief 启动后台刷写线程
+ *
+ * @param interval 刷写周期（秒），<= 0 时不启动
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_flusher_start(int interval)
+{
+    int *arg;
+
+    if (interval <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    arg = (int *)malloc(sizeof(int));
+    if (arg == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    *arg = interval;
+
+    super.flusher_stop = false;
+    if (pthread_create(&super.flusher, NULL, newfs_flusher, arg) != 0)
+    {
+        free(arg);
+        return -NFS_ERROR_UNSUPPORTED;
+    }
+    super.flusher_running = true;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止后台刷写线程，等待正在进行的刷写结束
+ */
+void newfs_flusher_stop()
+{
+    if (!super.flusher_running)
+    {
+        return;
+    }
+    NFS_LOCK();
+    super.flusher_stop = true;
+    pthread_cond_signal(&super.flush_cond);
+    NFS_UNLOCK();
+    pthread_join(super.flusher, NULL);
+    super.flusher_running = false;
+}
@@ -0,0 +1,826 @@
+#include "newfs.h"
+
+/******************************************************************************
+* SECTION: 文件数据页缓存
+*
+* 普通文件的数据不经过块缓存，而是按 (inode, 逻辑块号) 缓存在页中：
+*   - 每个文件一张页哈希表，首次访问数据时建立，最后一页离开时释放
+*   - 容量上限与置换是全局的：所有页挂在一条 LRU 链表上，
+*     满时从最久未访问的一端置换，要置换脏页时先把所有脏页合并写回
+*   - 读命中直接拷贝，不访问驱动；未命中时整块读入，未分配的块视为全 0
+*   - newfs_pcache_readahead 把一段逻辑块一次性批量读入，供顺序读预读使用
+*   - 写只修改页并标脏，部分覆盖的首尾块才需要读入旧内容，
+*     整块覆盖和文件末尾之后的块不读盘
+*   - 延迟分配：写入时不分配物理块，只按页数预留空闲块；
+*     写回时每个文件逻辑连续的脏页一次分配出物理连续的一段，
+*     多次小的追加写最终只占一段连续的块
+*   - newfs_pcache_sync 把脏页按物理块号排序，物理连续的脏页合并成一次向量写，
+*     所有请求一次性异步提交；newfs_flush 在提交元数据日志之前调用它，
+*     保证元数据引用的数据块已经落盘
+*   - 调用者持有 NFS_LOCK
+*******************************************************************************/
+extern struct newfs_super super;
+
+#define NFS_PCACHE_HASH(inode, lblk)  ((uint32_t)(lblk) & ((inode)->pages_sz - 1))
+#define NFS_PCACHE_MAX_IOV            64    /* 单次合并写回的最大页数 */
+
+/**
+ * @brief 初始化页缓存
+ *
+ * @param capacity 最多缓存的页数，<= 0 时使用默认值
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_pcache_init(int capacity)
+{
+    struct newfs_pcache *pcache = &super.pcache;
+
+    memset(pcache, 0, sizeof(struct newfs_pcache));
+    pcache->capacity = capacity > 0 ? capacity : NFS_PCACHE_DEFAULT_PAGES;
+    pcache->lru.lru_prev = &pcache->lru;
+    pcache->lru.lru_next = &pcache->lru;
+    return NFS_ERROR_NONE;
+}
+
+static void newfs_pcache_lru_del(struct newfs_page *page)
+{
+    page->lru_prev->lru_next = page->lru_next;
+    page->lru_next->lru_prev = page->lru_prev;
+}
+
+static void newfs_pcache_lru_add(struct newfs_page *page)
+{
+    struct newfs_page *head = &super.pcache.lru;
+
+    page->lru_next = head->lru_next;
+    page->lru_prev = head;
+    head->lru_next->lru_prev = page;
+    head->lru_next = page;
+}
+
+/**
+ * @brief 在文件的页哈希表中查找逻辑块
+ */
+static struct newfs_page *newfs_pcache_lookup(struct newfs_inode *inode, int lblk)
+{
+    struct newfs_page *page;
+
+    if (inode->pages == NULL)
+    {
+        return NULL;
+    }
+    for (page = inode->pages[NFS_PCACHE_HASH(inode, lblk)]; page; page = page->hash_next)
+    {
+        if (page->lblk == lblk)
+        {
+            return page;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 页数超过桶数时将哈希表扩大一倍并重新散列
+ */
+static int newfs_pcache_hash_grow(struct newfs_inode *inode)
+{
+    uint32_t sz = inode->pages_sz ? inode->pages_sz * 2 : 16;
+    struct newfs_page **pages = (struct newfs_page **)calloc(sz, sizeof(struct newfs_page *));
+
+    if (pages == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (uint32_t i = 0; i < inode->pages_sz; i++)
+    {
+        struct newfs_page *page = inode->pages[i];
+
+        while (page)
+        {
+            struct newfs_page *next = page->hash_next;
+
+            page->hash_next = pages[(uint32_t)page->lblk & (sz - 1)];
+            pages[(uint32_t)page->lblk & (sz - 1)] = page;
+            page = next;
+        }
+    }
+    free(inode->pages);
+    inode->pages = pages;
+    inode->pages_sz = sz;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 文件有 cnt 个延迟分配的页、分布在逻辑块 [lo, hi] 中时需要预留的块数
+ */
+static int newfs_pcache_inode_resv(struct newfs_inode *inode, int cnt, int lo, int hi)
+{
+    return cnt == 0 ? 0 : cnt + newfs_bmap_meta_blks(inode, lo, hi, cnt);
+}
+
+/**
+ * @brief 文件的逻辑块 lblk 变为（delta 为 1）或不再是（delta 为 -1）延迟分配的脏页
+ *
+ * 更新文件和全局的延迟分配页数，并按文件当前的间接块重新计算其预留块数。
+ * 页数减少时范围不收缩，直到降为 0 才清空，预留因此仍是上界
+ */
+static void newfs_pcache_delalloc(struct newfs_inode *inode, int lblk, int delta)
+{
+    int resv;
+
+    if (delta > 0)
+    {
+        if (inode->delalloc_cnt == 0 || lblk < inode->delalloc_lo)
+        {
+            inode->delalloc_lo = lblk;
+        }
+        if (inode->delalloc_cnt == 0 || lblk > inode->delalloc_hi)
+        {
+            inode->delalloc_hi = lblk;
+        }
+    }
+    inode->delalloc_cnt += delta;
+    super.pcache.delalloc_cnt += delta;
+
+    resv = newfs_pcache_inode_resv(inode, inode->delalloc_cnt, inode->delalloc_lo, inode->delalloc_hi);
+    super.pcache.resv_blks += resv - inode->resv_blks;
+    inode->resv_blks = resv;
+}
+
+/**
+ * @brief 将页从所属文件和 LRU 中摘除，文件的最后一页离开时释放其哈希表
+ */
+static void newfs_pcache_unlink(struct newfs_page *page)
+{
+    struct newfs_inode *inode = page->inode;
+    struct newfs_page **link = &inode->pages[NFS_PCACHE_HASH(inode, page->lblk)];
+
+    while (*link)
+    {
+        if (*link == page)
+        {
+            *link = page->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    newfs_pcache_lru_del(page);
+    if (page->is_dirty)
+    {
+        super.pcache.dirty_cnt--;
+        if (page->block_no == 0)
+        {
+            newfs_pcache_delalloc(inode, page->lblk, -1);
+        }
+    }
+    super.pcache.page_cnt--;
+    if (--inode->page_cnt == 0)
+    {
+        free(inode->pages);
+        inode->pages = NULL;
+        inode->pages_sz = 0;
+    }
+}
+
+static void newfs_pcache_free(struct newfs_page *page)
+{
+    newfs_pcache_unlink(page);
+    free(page->data);
+    free(page);
+}
+
+/**
+ * @brief 释放页缓存（不写回，调用前应先 newfs_pcache_sync）
+ */
+void newfs_pcache_destroy()
+{
+    struct newfs_pcache *pcache = &super.pcache;
+
+    while (pcache->lru.lru_next && pcache->lru.lru_next != &pcache->lru)
+    {
+        newfs_pcache_free(pcache->lru.lru_next);
+    }
+}
+
+/**
+ * @brief 从 LRU 尾部置换一页；被钉住的页跳过
+ *
+ * 选中的页是脏页（包括尚未分配物理块的页）时不单独写回，而是调用 newfs_pcache_sync
+ * 为所有延迟分配的页分配物理块并把所有脏页合并写回，顺序写产生的大量脏页因此仍以大块连续写落盘
+ *
+ * @return struct newfs_page* 摘下来的页（保留 data 供复用），没有可置换的页返回 NULL
+ */
+static struct newfs_page *newfs_pcache_evict()
+{
+    struct newfs_page *head = &super.pcache.lru;
+    struct newfs_page *page;
+
+    for (page = head->lru_prev; page != head; page = page->lru_prev)
+    {
+        if (page->pin > 0)
+        {
+            continue;
+        }
+        if (page->is_dirty && (newfs_pcache_sync() != NFS_ERROR_NONE || page->is_dirty))
+        {
+            return NULL;
+        }
+        newfs_pcache_unlink(page);
+        super.pcache.evict_cnt++;
+        return page;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 为文件的逻辑块建立一个新页并挂入哈希表和 LRU，页内容未初始化
+ *
+ * 缓存已满时置换一页并复用其内存
+ *
+ * @return struct newfs_page* 页，失败返回 NULL
+ */
+static struct newfs_page *newfs_pcache_add(struct newfs_inode *inode, int lblk, int block_no)
+{
+    struct newfs_pcache *pcache = &super.pcache;
+    struct newfs_page *page;
+    int slot;
+
+    page = pcache->page_cnt >= pcache->capacity ? newfs_pcache_evict() : NULL;
+    if (page == NULL)
+    {
+        page = (struct newfs_page *)calloc(1, sizeof(struct newfs_page));
+        if (page == NULL || (page->data = (uint8_t *)malloc(NFS_BLKS_SZ())) == NULL)
+        {
+            free(page);
+            return NULL;
+        }
+    }
+    /* 置换可能摘走本文件的最后一页并释放其哈希表，因此在置换之后再扩表 */
+    if (inode->page_cnt >= inode->pages_sz && newfs_pcache_hash_grow(inode) != NFS_ERROR_NONE)
+    {
+        free(page->data);
+        free(page);
+        return NULL;
+    }
+
+    page->lblk = lblk;
+    page->block_no = block_no;
+    page->is_dirty = false;
+    page->pin = 0;
+    page->inode = inode;
+
+    slot = NFS_PCACHE_HASH(inode, lblk);
+    page->hash_next = inode->pages[slot];
+    inode->pages[slot] = page;
+    inode->page_cnt++;
+    pcache->page_cnt++;
+    newfs_pcache_lru_add(page);
+    return page;
+}
+
+/**
+ * @brief 获取文件一个逻辑块的页
+ *
+ * @param lblk 逻辑块号
+ * @param fill 未命中时是否读入块内容；为 false 时调用者会覆盖整页，页先清零
+ * @return struct newfs_page* 页，失败返回 NULL
+ */
+static struct newfs_page *newfs_pcache_get(struct newfs_inode *inode, int lblk, bool fill)
+{
+    struct newfs_pcache *pcache = &super.pcache;
+    struct newfs_page *page = newfs_pcache_lookup(inode, lblk);
+    int block_no;
+
+    if (page)
+    {
+        pcache->hit_cnt++;
+        newfs_pcache_lru_del(page);
+        newfs_pcache_lru_add(page);
+        return page;
+    }
+
+    pcache->miss_cnt++;
+    if ((block_no = newfs_bmap(inode, lblk)) < 0)
+    {
+        return NULL;
+    }
+    page = newfs_pcache_add(inode, lblk, block_no);
+    if (page == NULL)
+    {
+        return NULL;
+    }
+    if (fill && page->block_no != 0)
+    {
+        if (newfs_dev_read((off_t)page->block_no * NFS_BLKS_SZ(), page->data, NFS_BLKS_SZ()) < 0)
+        {
+            newfs_pcache_free(page);
+            return NULL;
+        }
+    }
+    else
+    {
+        memset(page->data, 0, NFS_BLKS_SZ());
+    }
+    return page;
+}
+
+/**
+ * @brief 把文件的逻辑块 [lblk, lblk + cnt) 读入页缓存
+ *
+ * 已缓存的块和文件空洞跳过，其余块按物理块号连续的段合并成向量读，
+ * 一次性异步提交。读入期间新页被钉住，不会互相置换；
+ * 单次预读的页数不超过缓存容量的一半
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_pcache_readahead(struct newfs_inode *inode, int lblk, int cnt)
+{
+    struct newfs_pcache *pcache = &super.pcache;
+    struct ddriver_aio_req *reqs, **preqs;
+    struct newfs_page **pages;
+    struct iovec *iov;
+    int page_cnt = 0, req_cnt = 0, ret;
+
+    if (cnt > pcache->capacity / 2)
+    {
+        cnt = pcache->capacity / 2;
+    }
+    if (cnt <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    pages = (struct newfs_page **)calloc(cnt, sizeof(struct newfs_page *));
+    reqs = (struct ddriver_aio_req *)calloc(cnt, sizeof(struct ddriver_aio_req));
+    preqs = (struct ddriver_aio_req **)calloc(cnt, sizeof(struct ddriver_aio_req *));
+    iov = (struct iovec *)calloc(cnt, sizeof(struct iovec));
+    if (pages == NULL || reqs == NULL || preqs == NULL || iov == NULL)
+    {
+        ret = -NFS_ERROR_NOSPACE;
+        goto out;
+    }
+
+    for (int i = lblk; i < lblk + cnt; i++)
+    {
+        struct newfs_page *page;
+        int block_no;
+
+        if (newfs_pcache_lookup(inode, i) || (block_no = newfs_bmap(inode, i)) <= 0)
+        {
+            continue;
+        }
+        if ((page = newfs_pcache_add(inode, i, block_no)) == NULL)
+        {
+            break;
+        }
+        page->pin++;
+        iov[page_cnt].iov_base = page->data;
+        iov[page_cnt].iov_len = NFS_BLKS_SZ();
+
+        /* 逻辑与物理都紧接上一页时并入同一个请求 */
+        if (page_cnt > 0 && pages[page_cnt - 1]->lblk == i - 1
+            && pages[page_cnt - 1]->block_no == block_no - 1 && reqs[req_cnt - 1].iovcnt < NFS_PCACHE_MAX_IOV)
+        {
+            reqs[req_cnt - 1].iovcnt++;
+        }
+        else
+        {
+            reqs[req_cnt].op = DDRIVER_AIO_READ;
+            reqs[req_cnt].offset = (off_t)block_no * NFS_BLKS_SZ();
+            reqs[req_cnt].iov = &iov[page_cnt];
+            reqs[req_cnt].iovcnt = 1;
+            reqs[req_cnt].priv = &pages[page_cnt];
+            preqs[req_cnt] = &reqs[req_cnt];
+            req_cnt++;
+        }
+        pages[page_cnt++] = page;
+    }
+
+    ret = newfs_aio_run(preqs, req_cnt);
+    for (int i = 0; i < req_cnt; i++)
+    {
+        struct newfs_page **run_pages = (struct newfs_page **)reqs[i].priv;
+
+        for (int j = 0; j < reqs[i].iovcnt; j++)
+        {
+            run_pages[j]->pin--;
+            if (reqs[i].res < 0)
+            {
+                newfs_pcache_free(run_pages[j]);   /* 读失败的页丢弃，之后访问时重新读取 */
+            }
+        }
+        if (reqs[i].res >= 0)
+        {
+            pcache->ra_cnt += reqs[i].iovcnt;
+            pcache->ra_req_cnt++;
+        }
+    }
+
+out:
+    free(pages);
+    free(reqs);
+    free(preqs);
+    free(iov);
+    return ret;
+}
+
+static void newfs_pcache_mark_dirty(struct newfs_page *page)
+{
+    if (!page->is_dirty)
+    {
+        page->is_dirty = true;
+        super.pcache.dirty_cnt++;
+        if (page->block_no == 0)
+        {
+            newfs_pcache_delalloc(page->inode, page->lblk, 1);
+        }
+    }
+}
+
+/**
+ * @brief 扣除延迟分配预留之后的空闲块数
+ */
+int newfs_pcache_free_blks()
+{
+    int free_blks = super.data_free - super.pcache.resv_blks;
+
+    return free_blks > 0 ? free_blks : 0;
+}
+
+/**
+ * @brief 为没有缓存页的 inode（目录）设置预留块数，与延迟分配的预留共用一个额度
+ *
+ * @return int 0成功，预留增加而空闲块不够时返回 -NFS_ERROR_NOSPACE
+ */
+int newfs_pcache_resv(struct newfs_inode *inode, int blks)
+{
+    if (blks > inode->resv_blks && super.pcache.resv_blks - inode->resv_blks + blks > super.data_free)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    super.pcache.resv_blks += blks - inode->resv_blks;
+    inode->resv_blks = blks;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为延迟分配的页分配物理块时最多会弄脏的元数据块数：间接块和数据位图块
+ *
+ * 一段逻辑连续的页用一次分配得到连续的块，位图块数按块数估计即可
+ */
+int newfs_pcache_meta_blks()
+{
+    int cnt = super.pcache.delalloc_cnt;
+
+    if (cnt == 0)
+    {
+        return 0;
+    }
+    return super.pcache.resv_blks - cnt + cnt / (NFS_BLKS_SZ() * 8) + 1;
+}
+
+/**
+ * @brief 读文件数据，调用者保证 [offset, offset + size) 不超出文件大小
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_pcache_read(struct newfs_inode *inode, int offset, uint8_t *buf, int size)
+{
+    while (size > 0)
+    {
+        int lblk = offset / NFS_BLKS_SZ();
+        int bias = offset % NFS_BLKS_SZ();
+        int len = NFS_BLKS_SZ() - bias < size ? NFS_BLKS_SZ() - bias : size;
+        struct newfs_page *page = newfs_pcache_get(inode, lblk, true);
+
+        if (page == NULL)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf, page->data + bias, len);
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 写文件数据，只修改页缓存，物理块在写回时才分配
+ *
+ * 写入前按需要新分配的块数检查空闲空间，保证写回时的分配不会失败。
+ * 调用者负责更新文件大小
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_pcache_write(struct newfs_inode *inode, int offset, const uint8_t *buf, int size)
+{
+    int first = offset / NFS_BLKS_SZ();
+    int last = (offset + size - 1) / NFS_BLKS_SZ();
+    int new_cnt = 0, lo = first, hi = last;
+
+    if (size <= 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+
+    /* 既未映射、也没有延迟分配的块需要新预留，连同它们所需的间接块按文件计算 */
+    for (int lblk = first; lblk <= last; lblk++)
+    {
+        struct newfs_page *page = newfs_pcache_lookup(inode, lblk);
+        int block_no = page ? page->block_no : newfs_bmap(inode, lblk);
+
+        if (block_no < 0)
+        {
+            return block_no;
+        }
+        if (block_no == 0 && !(page && page->is_dirty))
+        {
+            new_cnt++;
+        }
+    }
+    if (inode->delalloc_cnt > 0)
+    {
+        lo = inode->delalloc_lo < lo ? inode->delalloc_lo : lo;
+        hi = inode->delalloc_hi > hi ? inode->delalloc_hi : hi;
+    }
+    if (super.pcache.resv_blks - inode->resv_blks
+        + newfs_pcache_inode_resv(inode, inode->delalloc_cnt + new_cnt, lo, hi) > super.data_free)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    /* 每一页取得后立即拷贝并标脏，其间没有分配或其他取页操作，页不会被置换，不需要钉住 */
+    while (size > 0)
+    {
+        int lblk = offset / NFS_BLKS_SZ();
+        int bias = offset % NFS_BLKS_SZ();
+        int len = NFS_BLKS_SZ() - bias < size ? NFS_BLKS_SZ() - bias : size;
+        struct newfs_page *page = newfs_pcache_get(inode, lblk, len != NFS_BLKS_SZ());
+
+        if (page == NULL)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(page->data + bias, buf, len);
+        newfs_pcache_mark_dirty(page);
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 文件大小改为 size：丢弃之后的页，末尾所在页中 size 之后的部分清零
+ *
+ * 保证文件末尾之后的字节总是 0，之后扩大文件时不会读到截掉的旧数据。
+ * 物理块的释放由调用者通过 newfs_unmap_blocks 完成
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_pcache_truncate(struct newfs_inode *inode, int size)
+{
+    int keep = (size + NFS_BLKS_SZ() - 1) / NFS_BLKS_SZ();
+    int bias = size % NFS_BLKS_SZ();
+
+    /* 释放最后一页时哈希表随之释放，因此每轮都重新检查 inode->pages */
+    for (uint32_t i = 0; inode->pages && i < inode->pages_sz; i++)
+    {
+        struct newfs_page *page = inode->pages[i];
+
+        while (page)
+        {
+            struct newfs_page *next = page->hash_next;
+
+            if (page->lblk >= keep)
+            {
+                newfs_pcache_free(page);
+                if (inode->pages == NULL)
+                {
+                    break;
+                }
+            }
+            page = next;
+        }
+    }
+
+    if (bias != 0 && size < (int)inode->size)
+    {
+        struct newfs_page *page = newfs_pcache_get(inode, size / NFS_BLKS_SZ(), true);
+
+        if (page == NULL)
+        {
+            return -NFS_ERROR_IO;
+        }
+        memset(page->data + bias, 0, NFS_BLKS_SZ() - bias);
+        if (page->block_no != 0)
+        {
+            newfs_pcache_mark_dirty(page);
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+static int newfs_page_lblk_cmp(const void *a, const void *b)
+{
+    const struct newfs_page *x = *(const struct newfs_page **)a;
+    const struct newfs_page *y = *(const struct newfs_page **)b;
+
+    if (x->inode != y->inode)
+    {
+        return x->inode->ino < y->inode->ino ? -1 : 1;
+    }
+    return x->lblk - y->lblk;
+}
+
+/**
+ * @brief 为所有延迟分配的脏页分配物理块
+ *
+ * 按 (inode, 逻辑块号) 排序后，同一文件中逻辑连续的一段页用一次 newfs_map_blocks 分配，
+ * 目标位置紧接前一个逻辑块，文件在磁盘上因此保持连续。分配改变了块映射，inode 随之标脏
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+static int newfs_pcache_alloc_delayed()
+{
+    struct newfs_pcache *pcache = &super.pcache;
+    struct newfs_page **pages, *page;
+    int cnt = 0, ret = NFS_ERROR_NONE;
+
+    pages = (struct newfs_page **)malloc(pcache->delalloc_cnt * sizeof(struct newfs_page *));
+    if (pages == NULL)
+    {
+        return -NFS_ERROR_NOSPACE;
+    }
+    for (page = pcache->lru.lru_next; page != &pcache->lru; page = page->lru_next)
+    {
+        if (page->is_dirty && page->block_no == 0)
+        {
+            pages[cnt++] = page;
+        }
+    }
+    qsort(pages, cnt, sizeof(struct newfs_page *), newfs_page_lblk_cmp);
+
+    for (int i = 0; i < cnt; )
+    {
+        struct newfs_inode *inode = pages[i]->inode;
+        int run = 1;
+
+        while (i + run < cnt && pages[i + run]->inode == inode
+               && pages[i + run]->lblk == pages[i]->lblk + run)
+        {
+            run++;
+        }
+        ret = newfs_map_blocks(inode, pages[i]->lblk, run);
+        if (ret != NFS_ERROR_NONE)
+        {
+            break;
+        }
+        for (int j = 0; j < run; j++)
+        {
+            int block_no = newfs_bmap(inode, pages[i + j]->lblk);
+
+            if (block_no <= 0)
+            {
+                ret = block_no < 0 ? block_no : -NFS_ERROR_IO;
+                break;
+            }
+            pages[i + j]->block_no = block_no;
+            newfs_pcache_delalloc(inode, pages[i + j]->lblk, -1);
+            pcache->alloc_cnt++;
+        }
+        newfs_mark_inode_dirty(inode);
+        pcache->alloc_req_cnt++;
+        if (ret != NFS_ERROR_NONE)
+        {
+            break;
+        }
+        i += run;
+    }
+    free(pages);
+    return ret;
+}
+
+static int newfs_page_cmp(const void *a, const void *b)
+{
+    const struct newfs_page *x = *(const struct newfs_page **)a;
+    const struct newfs_page *y = *(const struct newfs_page **)b;
+    return x->block_no - y->block_no;
+}
+
+/**
+ * @brief 为延迟分配的脏页分配物理块，再将所有脏页按物理块号升序写回
+ *
+ * 物理块号连续的脏页合并为一个向量写请求，所有请求一次性异步提交
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_pcache_sync()
+{
+    struct newfs_pcache *pcache = &super.pcache;
+    struct newfs_page **dirty_pages;
+    struct ddriver_aio_req *reqs = NULL, **preqs = NULL;
+    struct iovec *iov = NULL;
+    struct newfs_page *page;
+    int dirty_cnt = 0, req_cnt = 0;
+    int ret = NFS_ERROR_NONE, alloc_ret = NFS_ERROR_NONE;
+
+    if (pcache->dirty_cnt == 0)
+    {
+        return NFS_ERROR_NONE;
+    }
+    /* 分配中途失败时，已经分配到物理块的页照常写回，其余的页仍是延迟分配的脏页 */
+    if (pcache->delalloc_cnt > 0)
+    {
+        alloc_ret = newfs_pcache_alloc_delayed();
+    }
+
+    dirty_pages = (struct newfs_page **)malloc(pcache->dirty_cnt * sizeof(struct newfs_page *));
+    reqs = (struct ddriver_aio_req *)calloc(pcache->dirty_cnt, sizeof(struct ddriver_aio_req));
+    preqs = (struct ddriver_aio_req **)calloc(pcache->dirty_cnt, sizeof(struct ddriver_aio_req *));
+    iov = (struct iovec *)calloc(pcache->dirty_cnt, sizeof(struct iovec));
+    if (dirty_pages == NULL || reqs == NULL || preqs == NULL || iov == NULL)
+    {
+        ret = -NFS_ERROR_NOSPACE;
+        goto out;
+    }
+
+    for (page = pcache->lru.lru_next; page != &pcache->lru; page = page->lru_next)
+    {
+        if (page->is_dirty && page->block_no != 0)
+        {
+            dirty_pages[dirty_cnt++] = page;
+        }
+    }
+    qsort(dirty_pages, dirty_cnt, sizeof(struct newfs_page *), newfs_page_cmp);
+
+    for (int i = 0; i < dirty_cnt; )
+    {
+        int run = 1;
+
+        while (i + run < dirty_cnt && run < NFS_PCACHE_MAX_IOV
+               && dirty_pages[i + run]->block_no == dirty_pages[i]->block_no + run)
+        {
+            run++;
+        }
+        for (int j = 0; j < run; j++)
+        {
+            iov[i + j].iov_base = dirty_pages[i + j]->data;
+            iov[i + j].iov_len = NFS_BLKS_SZ();
+        }
+        reqs[req_cnt].op = DDRIVER_AIO_WRITE;
+        reqs[req_cnt].offset = (off_t)dirty_pages[i]->block_no * NFS_BLKS_SZ();
+        reqs[req_cnt].iov = &iov[i];
+        reqs[req_cnt].iovcnt = run;
+        reqs[req_cnt].priv = &dirty_pages[i];
+        preqs[req_cnt] = &reqs[req_cnt];
+        req_cnt++;
+        i += run;
+    }
+
+    ret = newfs_aio_run(preqs, req_cnt);
+    for (int i = 0; i < req_cnt; i++)
+    {
+        struct newfs_page **run_pages = (struct newfs_page **)reqs[i].priv;
+
+        if (reqs[i].res < 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < reqs[i].iovcnt; j++)
+        {
+            run_pages[j]->is_dirty = false;
+        }
+        pcache->dirty_cnt -= reqs[i].iovcnt;
+        pcache->writeback_cnt += reqs[i].iovcnt;
+        pcache->write_req_cnt++;
+    }
+
+out:
+    free(dirty_pages);
+    free(reqs);
+    free(preqs);
+    free(iov);
+    return alloc_ret != NFS_ERROR_NONE ? alloc_ret : ret;
+}
+
+/**
+ * @brief 文件是否还有未写回的页（延迟分配未完成或写回失败）
+ *
+ * newfs_pcache_sync 失败后由 newfs_flush 调用，这样的文件暂不刷写 inode，
+ * 避免提交指向未写入数据的块映射
+ */
+bool newfs_pcache_has_dirty(struct newfs_inode *inode)
+{
+    for (uint32_t i = 0; inode->pages && i < inode->pages_sz; i++)
+    {
+        for (struct newfs_page *page = inode->pages[i]; page; page = page->hash_next)
+        {
+            if (page->is_dirty)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -2,9 +2,9 @@
 POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
-# mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+# mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh) (crash.sh) (symlink.sh inline.sh) (bigrw.sh) (bigdir.sh)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh crash.sh symlink.sh inline.sh bigrw.sh bigdir.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 3 3 3 3 3)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
@@ -35,6 +35,10 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 崩溃恢复, symlink, 内联数据, 大文件读写, 大目录测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh crash.sh symlink.sh inline.sh bigrw.sh bigdir.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
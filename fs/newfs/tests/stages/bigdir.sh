@@ -0,0 +1,104 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - large directory"
+
+BIG_DIR="dir_many"
+# 名字长度从 1 到 127（newfs 能保存的最长名字）混合：26 个单字符、26 个双字符，
+# 再加 300 个 3 到 127 字符的名字，一个目录放不进一块，目录项也会跨越间接块
+NAMES=()
+for _C in {a..z}; do
+    NAMES+=("$_C" "$_C$_C")
+done
+for _I in $(seq 0 299); do
+    _LEN=$((3 + (_I * 37) % 125))
+    _NAME=$(printf '%03d' "$_I")
+    while (( ${#_NAME} < _LEN )); do
+        _NAME="${_NAME}n"
+    done
+    NAMES+=("$_NAME")
+done
+
+function check_ls_all () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    _MISSING=$(comm -23 <(printf '%s\n' "${NAMES[@]}" | sort) <(ls -A "$_PARAM" | sort) | head -1)
+    if [ -n "$_MISSING" ]; then
+        fail "$_TEST_CASE: $_MISSING没有在ls $_PARAM的输出结果中找到"
+        return 1
+    fi
+    _CNT=$(ls -A "$_PARAM" | wc -l)
+    if (( _CNT != ${#NAMES[@]} )); then
+        fail "$_TEST_CASE: ls $_PARAM输出了$_CNT项, 应为${#NAMES[@]}项"
+        return 1
+    fi
+    return 0
+}
+
+function create_many () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"
+    for _NAME in "${NAMES[@]}"; do
+        touch_and_check "$_PARAM/$_NAME"
+    done
+    check_ls_all "$_PARAM" "$_TEST_CASE"
+}
+
+function check_ls_all_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    check_ls_all "$_PARAM" "$_TEST_CASE"
+}
+
+# 空文件都内联在 inode 中，不占数据块：有效 inode 为根目录、$BIG_DIR 及其中的文件，
+# 有效数据块为根目录的一块、$BIG_DIR 的目录块，超过 6 个直接块后另有一个一级间接块。
+# checkbm 检查第一个位图字中块号最大的已分配块，即最后一个目录块，其中应有最后创建的名字
+function check_bm_many () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    _DIR_BLKS=$(( $(stat -c %s "$_PARAM") / 1024 ))
+    _VALID_DATA=$((1 + _DIR_BLKS))
+    if (( _DIR_BLKS > 6 )); then
+        _VALID_DATA=$((_VALID_DATA + 1))
+    fi
+    _RULES=$(mktemp)
+    echo "{ \"checks\": [ \"super\", \"data_map\", \"inode_map\", \"inode\" ], \"valid_inode\": $((${#NAMES[@]} + 2)), \"valid_data\": $_VALID_DATA }" > "$_RULES"
+    clean_mount
+    sleep 1
+
+    ROOT_PARENT_PATH=$(cd $(dirname $ROOT_PATH); pwd)
+    python3 "$ROOT_PATH"/checkbm/checkbm.py -l "$ROOT_PARENT_PATH"/include/fs.layout -r "$_RULES" -n "${NAMES[-1]}" > /dev/null
+    RET=$?
+    rm -f "$_RULES"
+    if (( RET != 0 )); then
+        fail "$_TEST_CASE: 位图或数据与预期不符（${#NAMES[@]} 个文件, $_DIR_BLKS 个目录块）, 请使用checkbm.py和ddriver工具自行检查"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 12.1 - create ${#NAMES[@]} entries in ${MNTPOINT}/$BIG_DIR and ls"
+core_tester echo "${MNTPOINT}/$BIG_DIR" create_many "$TEST_CASE"
+
+TEST_CASE="case 12.2 - ls ${MNTPOINT}/$BIG_DIR after remount"
+core_tester echo "${MNTPOINT}/$BIG_DIR" check_ls_all_remount "$TEST_CASE"
+
+TEST_CASE="case 12.3 - check bitmap"
+core_tester echo "${MNTPOINT}/$BIG_DIR" check_bm_many "$TEST_CASE"
+
+clean_mount
+clean_ddriver
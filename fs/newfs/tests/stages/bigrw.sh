@@ -0,0 +1,79 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - large read/write"
+
+GOLDEN_DIR=$(mktemp -d)
+# 约 700KB，跨越直接块和间接块
+seq 1 120000 > "$GOLDEN_DIR"/file13
+
+function check_same () {
+    _TEST_CASE=$1
+    _FILE=$2
+
+    if ! cmp -s "$GOLDEN_DIR/$_FILE" "${MNTPOINT}/$_FILE"; then
+        fail "$_TEST_CASE: 文件${MNTPOINT}/$_FILE的内容与写入的内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_big_write () {
+    _TEST_CASE=$2
+
+    if ! cp "$GOLDEN_DIR"/file13 "${MNTPOINT}"/file13; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/file13失败"
+        return 1
+    fi
+    if ! check_same "$_TEST_CASE" file13; then
+        return 1
+    fi
+    return 0
+}
+
+function check_big_modify () {
+    _TEST_CASE=$2
+
+    # 在文件中部覆盖写一段，再截短，同样的操作作用在对照文件上
+    for _FILE in "$GOLDEN_DIR"/file13 "${MNTPOINT}"/file13; do
+        if ! printf 'overwritten%.0s' $(seq 1 500) | dd of="$_FILE" bs=4096 seek=300001 oflag=seek_bytes conv=notrunc status=none; then
+            fail "$_TEST_CASE: 覆盖写文件$_FILE失败"
+            return 1
+        fi
+        if ! truncate -s 500000 "$_FILE"; then
+            fail "$_TEST_CASE: 截断文件$_FILE失败"
+            return 1
+        fi
+    done
+    if ! check_same "$_TEST_CASE" file13; then
+        return 1
+    fi
+    return 0
+}
+
+function check_big_remount () {
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    if ! check_same "$_TEST_CASE" file13; then
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 11.1 - write and read ${MNTPOINT}/file13"
+core_tester echo "$TEST_CASE" check_big_write "$TEST_CASE"
+
+TEST_CASE="case 11.2 - overwrite and truncate ${MNTPOINT}/file13"
+core_tester echo "$TEST_CASE" check_big_modify "$TEST_CASE"
+
+TEST_CASE="case 11.3 - compare contents after remount"
+core_tester echo "$TEST_CASE" check_big_remount "$TEST_CASE"
+
+rm -rf "$GOLDEN_DIR"
@@ -0,0 +1,131 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - crash recovery"
+
+GOLDEN_DIR=$(mktemp -d)
+# 约 340KB，跨越直接块和间接块；file15 是小文件
+seq 1 60000 > "$GOLDEN_DIR"/file14
+seq 1 300 > "$GOLDEN_DIR"/file15
+filename="$((RANDOM)).txt"
+
+# 不经 umount 直接杀掉文件系统进程，内存中尚未刷写的修改全部丢失
+function kill_fs () {
+    fs_pid=$(pgrep -u $USER $PROJECT_NAME)
+    if [ ! -z "$fs_pid" ]; then
+        for PID in $fs_pid; do
+            kill -9 $PID
+        done
+    fi
+    sleep 1
+    fusermount -u "${MNTPOINT}" 2>/dev/null
+}
+
+function check_same () {
+    _TEST_CASE=$1
+    _FILE=$2
+
+    if ! cmp -s "$GOLDEN_DIR/$_FILE" "${MNTPOINT}/$_FILE"; then
+        fail "$_TEST_CASE: 文件${MNTPOINT}/$_FILE的内容与写入的内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_kill_after_sync () {
+    _TEST_CASE=$2
+
+    mkdir_and_check "${MNTPOINT}"/dir3
+    for _FILE in file14 file15; do
+        if ! cp "$GOLDEN_DIR/$_FILE" "${MNTPOINT}/dir3/$_FILE"; then
+            fail "$_TEST_CASE: 写入文件${MNTPOINT}/dir3/$_FILE失败"
+            return 1
+        fi
+        # fsync：数据与元数据经日志落盘后才返回
+        sync "${MNTPOINT}/dir3/$_FILE"
+    done
+    kill_fs
+    try_mount_or_fail
+
+    for _FILE in file14 file15; do
+        if ! check_same "$_TEST_CASE" dir3/"$_FILE"; then
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_kill_while_writing () {
+    _TEST_CASE=$2
+
+    # 持续写入，写入过程中会提前刷写日志事务，进程在任意位置被杀掉
+    (
+        for i in $(seq 1 8); do
+            cp "$GOLDEN_DIR"/file14 "${MNTPOINT}"/file16_$i || break
+        done
+    ) 2>/dev/null &
+    writer_pid=$!
+    sleep 1
+    kill_fs
+    wait $writer_pid 2>/dev/null
+
+    # 挂载时重放已提交的事务，丢弃写了一半的事务
+    try_mount_or_fail
+    if ! ls "${MNTPOINT}" > /dev/null; then
+        fail "$_TEST_CASE: 崩溃后重新挂载无法列出${MNTPOINT}"
+        return 1
+    fi
+    for _FILE in file14 file15; do
+        if ! check_same "$_TEST_CASE" dir3/"$_FILE"; then
+            return 1
+        fi
+    done
+    # 写到一半的文件只能是完整内容的前缀
+    for _FILE in "${MNTPOINT}"/file16_*; do
+        if [ ! -e "$_FILE" ]; then
+            continue
+        fi
+        _SIZE=$(stat -c %s "$_FILE")
+        if ! cmp -s -n "$_SIZE" "$_FILE" "$GOLDEN_DIR"/file14; then
+            fail "$_TEST_CASE: 崩溃后文件$_FILE的内容不是写入内容的前缀"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_kill_bitmap () {
+    _TEST_CASE=$2
+
+    ROOT_PARENT_PATH=$(cd $(dirname $ROOT_PATH); pwd)
+    python3 "$ROOT_PATH"/checkbm/checkbm.py -l "$ROOT_PARENT_PATH"/include/fs.layout -r "$ROOT_PARENT_PATH"/tests/checkbm/golden.json -n "$filename" > /dev/null
+    if (( $? != 0 )); then
+        fail "$_TEST_CASE: 崩溃后位图或数据与预期不符, 请使用checkbm.py和ddriver工具自行检查"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - kill -9 after fsync, remount and compare"
+core_tester echo "$TEST_CASE" check_kill_after_sync "$TEST_CASE"
+
+TEST_CASE="case 8.2 - kill -9 while writing, remount and compare"
+core_tester echo "$TEST_CASE" check_kill_while_writing "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+
+sleep 1
+
+try_mount_or_fail
+
+touch_and_check "${MNTPOINT}/$filename"
+sync "${MNTPOINT}/$filename"
+kill_fs
+
+TEST_CASE="case 8.3 - check bitmap after kill -9"
+core_tester ls "${MNTPOINT}" check_kill_bitmap "$TEST_CASE"
+
+rm -rf "$GOLDEN_DIR"
@@ -0,0 +1,96 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - inline data"
+
+SMALL="inline content"
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat."
+
+function check_content () {
+    _GOLDEN=$1
+    _TEST_CASE=$2
+    _FILE=$3
+
+    OUTPUT=$(cat "${MNTPOINT}/$_FILE")
+    if [[ "${OUTPUT}" != "$_GOLDEN" ]]; then
+        fail "$_TEST_CASE: 读文件${MNTPOINT}/$_FILE成功, 但内容不同, 正确的内容为: $_GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+function check_promote () {
+    _TEST_CASE=$2
+
+    touch_and_check "${MNTPOINT}"/file11
+    if ! echo -n "$SMALL" > "${MNTPOINT}"/file11; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/file11失败"
+        return 1
+    fi
+    if ! check_content "$SMALL" "$_TEST_CASE" file11; then
+        return 1
+    fi
+    # 追加到超过 128 字节，文件从内联转为使用数据块
+    if ! echo -n "${GOLDEN:${#SMALL}}" >> "${MNTPOINT}"/file11; then
+        fail "$_TEST_CASE: 追加写文件${MNTPOINT}/file11失败"
+        return 1
+    fi
+    if ! check_content "${SMALL}${GOLDEN:${#SMALL}}" "$_TEST_CASE" file11; then
+        return 1
+    fi
+    return 0
+}
+
+function check_reinline () {
+    _TEST_CASE=$2
+
+    touch_and_check "${MNTPOINT}"/file12
+    if ! echo -n "$GOLDEN" > "${MNTPOINT}"/file12; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/file12失败"
+        return 1
+    fi
+    if ! truncate -s 0 "${MNTPOINT}"/file12; then
+        fail "$_TEST_CASE: 截断文件${MNTPOINT}/file12失败"
+        return 1
+    fi
+    if [[ $(stat -c %s "${MNTPOINT}"/file12) != "0" ]]; then
+        fail "$_TEST_CASE: 截断后文件${MNTPOINT}/file12大小不为0"
+        return 1
+    fi
+    if ! echo -n "$SMALL" > "${MNTPOINT}"/file12; then
+        fail "$_TEST_CASE: 截断后写入文件${MNTPOINT}/file12失败"
+        return 1
+    fi
+    if ! check_content "$SMALL" "$_TEST_CASE" file12; then
+        return 1
+    fi
+    return 0
+}
+
+function check_inline_remount () {
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    if ! check_content "${SMALL}${GOLDEN:${#SMALL}}" "$_TEST_CASE" file11; then
+        return 1
+    fi
+    if ! check_content "$SMALL" "$_TEST_CASE" file12; then
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - grow ${MNTPOINT}/file11 past 128 bytes"
+core_tester echo "$TEST_CASE" check_promote "$TEST_CASE"
+
+TEST_CASE="case 10.2 - truncate ${MNTPOINT}/file12 to 0 and rewrite"
+core_tester echo "$TEST_CASE" check_reinline "$TEST_CASE"
+
+TEST_CASE="case 10.3 - compare contents after remount"
+core_tester echo "$TEST_CASE" check_inline_remount "$TEST_CASE"
@@ -0,0 +1,75 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - symlink"
+
+SHORT_TARGET="dir0/file0"
+LONG_TARGET="$(printf 'long_target_%03d/' $(seq 1 20))file0"
+
+function check_symlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _LINK=$3
+
+    if ! ln -s "$_PARAM" "${MNTPOINT}/$_LINK"; then
+        fail "$_TEST_CASE: 创建符号链接${MNTPOINT}/$_LINK失败"
+        return 1
+    fi
+    if ! check_readlink "$_PARAM" "$_TEST_CASE" "$_LINK"; then
+        return 1
+    fi
+    return 0
+}
+
+function check_readlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _LINK=$3
+
+    if [ ! -L "${MNTPOINT}/$_LINK" ]; then
+        fail "$_TEST_CASE: ${MNTPOINT}/$_LINK不是符号链接"
+        return 1
+    fi
+    OUTPUT=$(readlink "${MNTPOINT}/$_LINK")
+    if [[ "${OUTPUT}" != "$_PARAM" ]]; then
+        fail "$_TEST_CASE: 读取符号链接${MNTPOINT}/$_LINK成功, 但目标不同, 正确的目标为: $_PARAM"
+        return 1
+    fi
+    return 0
+}
+
+function check_short_symlink () {
+    check_symlink "$SHORT_TARGET" "$2" link0
+}
+
+function check_long_symlink () {
+    check_symlink "$LONG_TARGET" "$2" link1
+}
+
+function check_symlink_remount () {
+    _TEST_CASE=$2
+
+    sleep 1
+    umount "${MNTPOINT}"
+    sleep 1
+    try_mount_or_fail
+
+    if ! check_readlink "$SHORT_TARGET" "$_TEST_CASE" link0; then
+        return 1
+    fi
+    if ! check_readlink "$LONG_TARGET" "$_TEST_CASE" link1; then
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - symlink with an inline target"
+core_tester echo "$TEST_CASE" check_short_symlink "$TEST_CASE"
+
+TEST_CASE="case 9.2 - symlink with a target longer than 128 bytes"
+core_tester echo "$TEST_CASE" check_long_symlink "$TEST_CASE"
+
+TEST_CASE="case 9.3 - readlink after remount"
+core_tester echo "$TEST_CASE" check_symlink_remount "$TEST_CASE"
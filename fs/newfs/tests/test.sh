@@ -11,7 +11,7 @@
 # fi 
 # cd - || exit
 
-read -r -p "请输入测试方式[N(基础功能测试) / E(进阶功能测试) / S(分阶段测试)]: " TEST_METHOD
+read -r -p "请输入测试方式[N(基础功能测试) / E(进阶功能测试) / X(扩展功能测试) / S(分阶段测试)]: " TEST_METHOD
 
 # 编译src
 cd ..; mkdir build >/dev/null 2>&1; cd build
@@ -30,6 +30,8 @@ mkdir mnt 2>/dev/null
 
 if [[ "${TEST_METHOD}" == "E" ]]; then
     ./main.sh "6"
+elif [[ "${TEST_METHOD}" == "X" ]]; then
+    ./main.sh "7"
 elif [[ "${TEST_METHOD}" == "N" ]]; then
     ./main.sh "4"
 else
@@ -39,10 +41,11 @@ else
     echo "----测试阶段4：增加 umount 及 remount 测试"
     echo "----测试阶段5：增加 read 及 write 测试"
     echo "----测试阶段6：增加 copy 测试"
-    read -r -p "按照你的进度输入测试等级[数字1-6]: " LEVEL 
-    if [[ "${LEVEL}" -ge "1" ]] && [[ "${LEVEL}" -le "6" ]]; then
+    echo "----测试阶段7：增加崩溃恢复、symlink、内联数据、大文件读写及大目录测试（均含 remount 后比对，不计入 E 的总分）"
+    read -r -p "按照你的进度输入测试等级[数字1-7]: " LEVEL 
+    if [[ "${LEVEL}" -ge "1" ]] && [[ "${LEVEL}" -le "7" ]]; then
         ./main.sh "${LEVEL}"
     else
-        echo "!! Wrong Test Level! Please input 1 to 6 !!"
+        echo "!! Wrong Test Level! Please input 1 to 7 !!"
     fi
 fi
\ No newline at end of file
@@ -13,9 +13,44 @@ struct ddriver_state
     int seek_cnt;
 };
 
+#define DDRIVER_SCHED_NOOP      0
+#define DDRIVER_SCHED_CLOOK     1
+#define DDRIVER_SCHED_DEADLINE  2
+
+struct ddriver_sched_state
+{
+    int       policy;
+    int       queued;
+    long long dispatch_cnt;
+    long long merge_cnt;
+    long long seek_dist;
+    long long seek_dist_fifo;
+};
+
+#define DDRIVER_HIST_BUCKETS    32
+
+struct ddriver_stat64
+{
+    long long read_cnt;
+    long long write_cnt;
+    long long seek_cnt;
+    long long read_bytes;
+    long long write_bytes;
+    long long read_lat_ns;
+    long long write_lat_ns;
+    long long seek_dist;
+    long long read_hist[DDRIVER_HIST_BUCKETS];
+    long long write_hist[DDRIVER_HIST_BUCKETS];
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_SET_SCHED_POLICY    _IOW(IOC_MAGIC, 4, int)
+#define IOC_REQ_SCHED_STATE     _IOR(IOC_MAGIC, 5, struct ddriver_sched_state)
+#define IOC_REQ_DEVICE_SYNC     _IO(IOC_MAGIC, 6)
+#define IOC_REQ_DEVICE_STAT64   _IOR(IOC_MAGIC, 7, struct ddriver_stat64)
+#define IOC_REQ_DEVICE_SIZE64   _IOR(IOC_MAGIC, 8, long long)
 
 #endif
\ No newline at end of file
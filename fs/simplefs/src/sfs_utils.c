@@ -49,16 +49,23 @@ int sfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      offset_aligned = SFS_ROUND_DOWN(offset, SFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    uint8_t* mapped         = ddriver_map_block(SFS_DRIVER(), offset_aligned, size_aligned,
+                                                DDRIVER_MAP_READ);
+    uint8_t* temp_content;
+    struct iovec iov;
+                                                      /* 设备可映射时直接从映像拷出，无需中转 */
+    if (mapped != NULL) {
+        memcpy(out_content, mapped + bias, size);
+        ddriver_unmap_block(SFS_DRIVER(), mapped, size_aligned, 0);
+        return SFS_ERROR_NONE;
+    }
+    temp_content = (uint8_t*)malloc(size_aligned);
+    iov.iov_base = temp_content;
+    iov.iov_len  = size_aligned;
+                                                      /* 一次向量读出所有扇区 */
+    if (ddriver_preadv(SFS_DRIVER(), &iov, 1, offset_aligned) < 0) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
@@ -76,19 +83,26 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      offset_aligned = SFS_ROUND_DOWN(offset, SFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
+    uint8_t* mapped         = ddriver_map_block(SFS_DRIVER(), offset_aligned, size_aligned,
+                                                bias == 0 && size == size_aligned ?
+                                                DDRIVER_MAP_WRITE : DDRIVER_MAP_READ);
+    uint8_t* temp_content;
+    struct iovec iov;
+                                                      /* 设备可映射时就地写入，首尾扇区无需预读；整扇区覆盖时不计读 */
+    if (mapped != NULL) {
+        memcpy(mapped + bias, in_content, size);
+        ddriver_unmap_block(SFS_DRIVER(), mapped, size_aligned, 1);
+        return SFS_ERROR_NONE;
+    }
+    temp_content = (uint8_t*)malloc(size_aligned);
+    iov.iov_base = temp_content;
+    iov.iov_len  = size_aligned;
     sfs_driver_read(offset_aligned, temp_content, size_aligned);
     memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+                                                      /* 一次向量写入所有扇区 */
+    if (ddriver_pwritev(SFS_DRIVER(), &iov, 1, offset_aligned) < 0) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
 
     free(temp_content);